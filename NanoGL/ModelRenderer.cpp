@@ -1,109 +1,691 @@
 #include "ModelRenderer.h"
+#include "tgawriter.h"
+
+#include <cassert>
+#include <cstring>
+#include <type_traits>
 
 ModelRenderer::ModelRenderer(const char* filenamme, TGAImage* AOImage, TGAImage* depthImage, float* zbuffer, float* shadowbuffer)
 	: m_AOImage(AOImage), m_DepthImage(depthImage), m_Zbuffer(zbuffer), m_ShadowBuffer(shadowbuffer)
 {
-	m_Model = new Model(filenamme);
+	m_Model = m_OwnedModel = new Model(filenamme);
 	m_Width = m_AOImage->GetWidth();
 	m_Height = m_AOImage->GetHeight();
 }
 
+ModelRenderer::ModelRenderer(const Model& model, TGAImage* AOImage, TGAImage* depthImage, float* zbuffer, float* shadowbuffer)
+	: m_Model(&model), m_AOImage(AOImage), m_DepthImage(depthImage), m_Zbuffer(zbuffer), m_ShadowBuffer(shadowbuffer)
+{
+	m_Width = m_AOImage->GetWidth();
+	m_Height = m_AOImage->GetHeight();
+}
+
+ModelRenderer::ModelRenderer(const Model& model, RenderTargetPool* targets)
+	: m_Model(&model)
+{
+	if (targets)
+		m_Targets = targets;
+}
+
 ModelRenderer::~ModelRenderer()
 {
-	delete m_Model;
+	delete m_OwnedModel;
 }
 
-float MaxElevationAngle(float* zbuffer, Vec2f p, Vec2f dir, int width, int height)
+static void DrawTriangle(Vec4f* pts, IShader& shader, TGAImage& target, DepthBuffer& depth, VisibilitySample* visibility, int face, int instance)
 {
-	float maxangle = 0;
+	if (visibility)
+		Triangle(pts, shader, target, depth, visibility, face, instance);
+	else
+		Triangle(pts, shader, target, depth);
+}
+
+// Multisample targets carry their own depth and record no visibility
+static void DrawTriangle(Vec4f* pts, IShader& shader, MultisampleImage& target, DepthBuffer&, VisibilitySample*, int, int)
+{
+	Triangle(pts, shader, target);
+}
+
+bool ModelRenderer::SetInstance(int instance, const Mat4x4& view) const
+{
+	if (m_Instances.empty())
+	{
+		::SetCullMode(m_CullMode, m_FrontFace);
+		return false;
+	}
+	const Mat4x4& transform = m_Instances[instance];
+	ModelView = view * transform;
+	// Mirroring transforms turn the winding of the faces on screen around
+	bool mirrored = transform.GetMinor(3, 3).Det() < 0;
+	Winding frontFace = m_FrontFace;
+	if (mirrored)
+		frontFace = frontFace == Winding::CounterClockwise ? Winding::Clockwise : Winding::CounterClockwise;
+	::SetCullMode(m_CullMode, frontFace);
+	return mirrored;
+}
+
+// The cone test works on object space normals, which mirroring doesn't change. Negating the axis undoes the flipped winding.
+static bool TestMeshletCone(const Vec4f& viewer, const Meshlet& meshlet, bool mirrored)
+{
+	return TestCone(viewer, meshlet.Center, meshlet.Radius, mirrored ? meshlet.ConeAxis * -1.0f : meshlet.ConeAxis, meshlet.ConeCutoff);
+}
+
+template<typename Target>
+void ModelRenderer::RenderPass(ProfilePass pass, IShader& shader, Target& target, DepthBuffer& depth, VisibilitySample* visibility)
+{
+	NANOGL_PROFILE_SCOPE(pass);
+	ResetRasterStats();
+
+	Mat4x4 view = ModelView;
+	int instanceCount = std::max(1, (int)m_Instances.size());
+	for (int instance = 0; instance < instanceCount; instance++)
+	{
+		bool mirrored = SetInstance(instance, view);
+		RenderInstance(instance, mirrored, shader, target, depth, visibility);
+	}
+	ModelView = view;
+
+	const RasterStats& stats = GetRasterStats();
+	m_PassStats[(int)pass] = stats;
+
+	NANOGL_PROFILE_COUNT(ProfileCounter::TrianglesSubmitted, stats.Submitted + stats.CulledByCluster);
+	NANOGL_PROFILE_COUNT(ProfileCounter::TrianglesCulled, stats.Culled() + stats.CulledByCluster);
+	NANOGL_PROFILE_COUNT(ProfileCounter::TrianglesRasterized, stats.Rasterized);
+}
+
+template<typename Target>
+void ModelRenderer::RenderInstance(int instance, bool mirrored, IShader& shader, Target& target, DepthBuffer& depth, VisibilitySample* visibility)
+{
+	// Walk the BVH, children of nodes completely inside the view volume skip the box test.
+	// Leaves are meshlets that are rejected as a whole when all their faces are culled by winding.
+	const std::vector<BVHNode>& bvh = m_Model->GetBVH();
+	const std::vector<Meshlet>& meshlets = m_Model->GetMeshlets();
+	Vec4f viewer = GetViewer();
+	// Median splits keep the height logarithmic, 64 levels would take 2^63 leaves
+	const int MaxStack = 64;
+	struct StackEntry { int Node; bool Inside; } stack[MaxStack];
+	assert(m_Model->GetBVHHeight() <= MaxStack);
+	int top = 0;
+	if (!bvh.empty())
+		stack[top++] = { 0, false };
+	while (top > 0)
+	{
+		StackEntry entry = stack[--top];
+		const BVHNode& node = bvh[entry.Node];
+		bool inside = entry.Inside;
+		if (!inside)
+		{
+			Visibility visibility = TestBox(node.BoundsMin, node.BoundsMax, target.GetWidth(), target.GetHeight());
+			if (visibility == Visibility::Outside)
+			{
+				GetRasterStats().CulledByCluster += node.FaceCount;
+				continue;
+			}
+			inside = visibility == Visibility::Inside;
+		}
+		if (node.RightChild >= 0)
+		{
+			stack[top++] = { node.RightChild, inside };
+			stack[top++] = { entry.Node + 1, inside };
+			continue;
+		}
+
+		const Meshlet& meshlet = meshlets[node.Meshlet];
+		if (TestMeshletCone(viewer, meshlet, mirrored))
+		{
+			GetRasterStats().CulledByCluster += meshlet.FaceCount;
+			continue;
+		}
+		RenderFaces(meshlet.FirstFace, meshlet.FaceCount, instance, shader, target, depth, visibility);
+	}
+}
+
+template<typename Target>
+void ModelRenderer::RenderFaces(int first, int count, int instance, IShader& shader, Target& target, DepthBuffer& depth, VisibilitySample* visibility)
+{
+	Vec4f screenCoords[3];
+	for (int i = first; i < first + count; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			screenCoords[j] = shader.Vertex(i, j);
+		}
+		DrawTriangle(screenCoords, shader, target, depth, visibility, i, instance);
+	}
+}
+
+// atan is monotonic, so the steepest slope is searched and only its angle is computed.
+// Exact keeps the Euclidean step distance, the approximations use the step count of the unit direction after the first
+// step. Whether a diagonal's first step falls below 1 depends on rounding at the pixel, so all of them measure it alike.
+template<MathPrecision P, typename DepthView>
+float MaxElevationAngle(const DepthView& zbuffer, Vec2f p, Vec2f dir, int width, int height)
+{
+	float maxslope = 0;
+	float z = zbuffer.Decode(zbuffer.Data[int(p.x) + int(p.y) * width]);
 	for (float t = 0.; t < 1000.; t += 1.)
 	{
 		Vec2f cur = p + dir * t;
-		if (cur.x >= width || cur.y >= height || cur.x < 0 || cur.y < 0) return maxangle;
+		if (cur.x >= width || cur.y >= height || cur.x < 0 || cur.y < 0) break;
 
-		float distance = (p - cur).Magnitude();
+		float distance = P == MathPrecision::Exact || t < 1.5f ? (p - cur).Magnitude() : t;
 		if (distance < 1.f) continue;
-		float elevation = zbuffer[int(cur.x) + int(cur.y) * width] - zbuffer[int(p.x) + int(p.y) * width];
-		maxangle = std::max(maxangle, atanf(elevation / distance));
+		float elevation = zbuffer.Decode(zbuffer.Data[int(cur.x) + int(cur.y) * width]) - z;
+		maxslope = std::max(maxslope, elevation / distance);
 	}
-	return maxangle;
+	return P == MathPrecision::Exact ? atanf(maxslope) : FastAtan<P>(maxslope);
 }
 
-void ModelRenderer::Render(TGAImage& frame, const Vec3f& eye, const Vec3f& center, const Vec3f& up, const Vec3f& lightDir)
+// Directions of the horizon sweep
+struct AODirectionTable
+{
+	static const int Count = 8;
+	Vec2f Directions[Count];
+
+	AODirectionTable()
+	{
+		int i = 0;
+		for (float a = 0; a < M_PI * 2 - 1e-4; a += M_PI / 4)
+			Directions[i++] = Vec2f(cos(a), sin(a));
+	}
+};
+
+static const AODirectionTable AODirections;
+
+// Horizon based ambient occlusion from the depth left by the AO pass
+void ModelRenderer::ComputeAmbientOcclusion(DepthBuffer& depth, TGAImage& AOImage)
+{
+	NANOGL_PROFILE_SCOPE(ProfilePass::AOHorizon);
+	depth.Resolve();
+	switch (depth.GetFormat())
+	{
+	case DepthFormat::Float32: ComputeAmbientOcclusion(depth.GetFloatView(), AOImage); break;
+	case DepthFormat::Unorm24: ComputeAmbientOcclusion(depth.GetUnorm24View(), AOImage); break;
+	case DepthFormat::Unorm16: ComputeAmbientOcclusion(depth.GetUnorm16View(), AOImage); break;
+	}
+}
+
+template<typename DepthView>
+void ModelRenderer::ComputeAmbientOcclusion(const DepthView& depth, TGAImage& AOImage)
+{
+	switch (m_MathPrecision)
+	{
+	case MathPrecision::Exact: ComputeAmbientOcclusion<MathPrecision::Exact>(depth, AOImage); break;
+	case MathPrecision::Medium: ComputeAmbientOcclusion<MathPrecision::Medium>(depth, AOImage); break;
+	case MathPrecision::Fast: ComputeAmbientOcclusion<MathPrecision::Fast>(depth, AOImage); break;
+	}
+}
+
+template<MathPrecision P, typename DepthView>
+void ModelRenderer::ComputeAmbientOcclusion(const DepthView& depth, TGAImage& AOImage)
+{
+	for (int x = 0; x < m_Width; x++) {
+		for (int y = 0; y < m_Height; y++) {
+			if (depth.IsEmpty(x + y * m_Width)) continue;
+			float total = 0;
+			for (const Vec2f& dir : AODirections.Directions) {
+				total += M_PI / 2 - MaxElevationAngle<P>(depth, Vec2f(x, y), dir, m_Width, m_Height);
+			}
+			total /= (M_PI / 2) * 8;
+			// The approximation can overshoot 1 slightly, which would wrap around in the 8-bit image
+			total = P == MathPrecision::Exact ? pow(total, 100.f) : std::min(FastPow<P>(total, 100.f), 1.0f);
+			AOImage.SetPixel(x, y, TGAColor(total * 255, total * 255, total * 255));
+		}
+	}
+}
+
+void ModelRenderer::SetCamera(const Camera& camera)
+{
+	LookAt(camera.Eye, camera.Center, camera.Up);
+	CreateViewportMatrix(m_Width / 8, m_Height / 8, m_Width * 3 / 4, m_Height * 3 / 4);
+	CreateProjectionMatrix(-1.0f / (camera.Eye - camera.Center).Magnitude());
+}
+
+Mat4x4 ModelRenderer::RenderShadowMap(const PassBuffers& buffers, const Camera& camera, const Vec3f& lightDir)
+{
+	std::clog << "Calculate Depth Map..." << std::endl;
+
+	LookAt(lightDir, camera.Center, camera.Up);
+	CreateViewportMatrix(m_Width / 8, m_Height / 8, m_Width * 3 / 4, m_Height * 3 / 4);
+	CreateProjectionMatrix(0);
+
+	DepthShader depthShader(*m_Model);
+	RenderPass(ProfilePass::ShadowMap, depthShader, *buffers.ShadowImage, *buffers.ShadowDepth);
+
+	std::clog << "DONE" << std::endl;
+	return Viewport * Projection * ModelView;
+}
+
+// Final shader of the current camera matrices
+Shader ModelRenderer::CreateShader(const Mat4x4& MShadow, const Vec3f& lightDir, const PassBuffers& buffers) const
+{
+	return Shader(Viewport*Projection*ModelView, (Viewport*Projection * ModelView).InvertTranspose(), MShadow * (Viewport * Projection * ModelView).Invert(), *m_Model, lightDir, buffers.ShadowDepth, buffers.AOImage, m_MathPrecision);
+}
+
+template<typename Target>
+void ModelRenderer::RenderFrame(Target& frame, const PassBuffers& buffers, const Camera& camera, const Vec3f& lightDir)
 {
 	m_Width = frame.GetWidth();
 	m_Height = frame.GetHeight();
 	{
 		std::clog << "Calculating Ambient Occlusion..." << std::endl;
-		LookAt(eye, center, up);
-		CreateViewportMatrix(m_Width / 8, m_Height / 8, m_Width * 3 / 4, m_Height * 3 / 4);
-		CreateProjectionMatrix(-1.0f / (eye - center).Magnitude());
+		SetCamera(camera);
 
+		// The depth left here is kept for the final pass, which then only shades the visible surface
 		ZShader zshader(*m_Model);
-		Vec4f screenCoords[3];
-		for (int i = 0; i < m_Model->nFaces(); i++) {
-			for (int j = 0; j < 3; j++) {
-				screenCoords[j] = zshader.Vertex(i, j);
-			}
-			Triangle(screenCoords, zshader, *m_AOImage, m_Zbuffer);
-		}
+		RenderPass(ProfilePass::AORaster, zshader, *buffers.AOImage, *buffers.Depth);
 
-		for (int x = 0; x < m_Width; x++) {
-			for (int y = 0; y < m_Height; y++) {
-				if (m_Zbuffer[x + y * m_Width] < -1e5) continue;
-				float total = 0;
-				for (float a = 0; a < M_PI * 2 - 1e-4; a += M_PI / 4) {
-					total += M_PI / 2 - MaxElevationAngle(m_Zbuffer, Vec2f(x, y), Vec2f(cos(a), sin(a)), m_Width, m_Height);
-				}
-				total /= (M_PI / 2) * 8;
-				total = pow(total, 100.f);
-				m_AOImage->SetPixel(x, y, TGAColor(total * 255, total * 255, total * 255));
-			}
-		}
+		ComputeAmbientOcclusion(*buffers.Depth, *buffers.AOImage);
+
+		std::clog << "DONE" << std::endl;
+	}
+	Mat4x4 MShadow = RenderShadowMap(buffers, camera, lightDir);
+
+	{
+		std::clog << "Rendering Final Image..." << std::endl;
+
+		SetCamera(camera);
+		Shader shader = CreateShader(MShadow, lightDir, buffers);
+		RenderPass(ProfilePass::FinalShading, shader, frame, *buffers.Depth, buffers.Visibility);
 
 		std::clog << "DONE" << std::endl;
 	}
+}
+
+template<typename Target>
+bool ModelRenderer::RenderToMemory(Target& frame, DepthBuffer& depth, const Camera& camera, const Vec3f& lightDir, const RenderOutputs& outputs)
+{
+	int width = frame.GetWidth(), height = frame.GetHeight();
+	TGAImage* AO = outputs.AmbientOcclusion;
+	TGAImage* shadow = outputs.ShadowMap;
+	if (depth.GetWidth() != width || depth.GetHeight() != height || !MatchesFrame(outputs, width, height))
 	{
-		std::clog << "Calculate Depth Map..." << std::endl;
+		std::cerr << "Render buffers don't match the " << width << "x" << height << " frame" << std::endl;
+		return false;
+	}
 
-		LookAt(lightDir, center, up);
-		CreateViewportMatrix(m_Width / 8, m_Height / 8, m_Width * 3 / 4, m_Height * 3 / 4);
-		CreateProjectionMatrix(0);
+	m_Width = width;
+	m_Height = height;
 
-		DepthShader depthShader(*m_Model);
-		Vec4f screenCoords[3];
-		for (int i = 0; i < m_Model->nFaces(); i++)
+	// The shading pass reads the AO image, so it is always rendered, into pooled memory unless requested
+	if (AO)
+		AO->Clear();
+	else
+		AO = &m_Targets->AcquireImage(width, height, 3);
+	if (shadow)
+		shadow->Clear();
+	else
+		shadow = &m_Targets->AcquireImage(width, height, 1);
+	// The shadow map gets a lazily cleared buffer of its own, light space tiles nothing projects to are never written
+	DepthBuffer& shadowDepth = m_Targets->AcquireDepth(width, height, m_ShadowMapFormat);
+
+	// Multisampled frames have no single fragment per pixel to record
+	VisibilitySample* visibility = nullptr;
+	m_HasVisibility = false;
+	if (m_Incremental && std::is_same<Target, TGAImage>::value)
+	{
+		m_Visibility.assign((size_t)width * height, VisibilitySample{ -1, 0, Vec3f(0, 0, 0) });
+		visibility = m_Visibility.data();
+	}
+
+	RenderFrame(frame, PassBuffers{ AO, shadow, &depth, &shadowDepth, visibility }, camera, lightDir);
+
+	if (visibility)
+		KeepVisibility(camera, *AO);
+	if (AO != outputs.AmbientOcclusion)
+		m_Targets->Release(*AO);
+	if (shadow != outputs.ShadowMap)
+		m_Targets->Release(*shadow);
+	m_Targets->Release(shadowDepth);
+	return true;
+}
+
+bool ModelRenderer::MatchesFrame(const RenderOutputs& outputs, int width, int height) const
+{
+	const TGAImage* AO = outputs.AmbientOcclusion;
+	const TGAImage* shadow = outputs.ShadowMap;
+	return !(AO && (AO->GetWidth() != width || AO->GetHeight() != height || AO->GetBytesPerPixel() < 3))
+		&& !(shadow && (shadow->GetWidth() != width || shadow->GetHeight() != height));
+}
+
+// Stable counting sort of pixels by a key below keyCount, offsets receives the start of every key's pixels in sorted
+template<typename Key>
+static void SortPixels(const std::vector<int>& pixels, std::vector<int>& sorted, std::vector<int>& offsets, int keyCount, Key key)
+{
+	offsets.assign(keyCount + 1, 0);
+	for (int pixel : pixels)
+		offsets[key(pixel) + 1]++;
+	for (size_t k = 1; k < offsets.size(); k++)
+		offsets[k] += offsets[k - 1];
+
+	// Placing a pixel advances its key's offset to the start of the next key, which is shifted back afterwards
+	sorted.resize(pixels.size());
+	for (int pixel : pixels)
+		sorted[offsets[key(pixel)]++] = pixel;
+	for (size_t k = offsets.size() - 1; k > 0; k--)
+		offsets[k] = offsets[k - 1];
+	offsets[0] = 0;
+}
+
+// Groups the covered pixels by face and instance, so that Relight() runs the vertex shader once per visible face of an instance
+void ModelRenderer::KeepVisibility(const Camera& camera, const TGAImage& AOImage)
+{
+	m_CoveredPixels.clear();
+	for (int i = 0; i < (int)m_Visibility.size(); i++)
+	{
+		if (m_Visibility[i].Face >= 0)
+			m_CoveredPixels.push_back(i);
+	}
+	// Sorting by instance first leaves the instances in order within each face
+	if (m_Instances.size() > 1)
+	{
+		SortPixels(m_CoveredPixels, m_ShadeOrder, m_FaceOffsets, (int)m_Instances.size(), [this](int pixel) { return m_Visibility[pixel].Instance; });
+		std::swap(m_CoveredPixels, m_ShadeOrder);
+	}
+	SortPixels(m_CoveredPixels, m_ShadeOrder, m_FaceOffsets, m_Model->nFaces(), [this](int pixel) { return m_Visibility[pixel].Face; });
+
+	if (m_KeptAO.GetWidth() != m_Width || m_KeptAO.GetHeight() != m_Height || m_KeptAO.GetBytesPerPixel() != AOImage.GetBytesPerPixel())
+		m_KeptAO = TGAImage(m_Width, m_Height, AOImage.GetBytesPerPixel());
+	for (int y = 0; y < m_Height; y++)
+		memcpy(m_KeptAO.GetRow(y), AOImage.GetRow(y), (size_t)m_Width * AOImage.GetBytesPerPixel());
+
+	m_VisibilityCamera = camera;
+	m_HasVisibility = true;
+}
+
+void ModelRenderer::ShadeVisibility(IShader& shader, TGAImage& frame) const
+{
+	Mat4x4 view = ModelView;
+	TGAColor color;
+	for (int face = 0; face + 1 < (int)m_FaceOffsets.size(); face++)
+	{
+		int instance = -1;
+		for (int k = m_FaceOffsets[face]; k < m_FaceOffsets[face + 1]; k++)
 		{
-			for (int j = 0; j < 3; j++)
+			int pixel = m_ShadeOrder[k];
+			const VisibilitySample& sample = m_Visibility[pixel];
+			if (sample.Instance != instance)
 			{
-				screenCoords[j] = depthShader.Vertex(i, j);
+				instance = sample.Instance;
+				SetInstance(instance, view);
+				for (int j = 0; j < 3; j++)
+					shader.Vertex(face, j);
 			}
-			Triangle(screenCoords, depthShader, *m_DepthImage, m_ShadowBuffer);
+			if (!shader.Fragment(sample.Bar, color))
+				frame.SetPixel(pixel % m_Width, pixel / m_Width, color);
 		}
+	}
+	ModelView = view;
+}
 
-		std::clog << "DONE" << std::endl;
+bool ModelRenderer::Relight(TGAImage& frame, const Vec3f& lightDir, const RenderOutputs& outputs)
+{
+	int width = frame.GetWidth(), height = frame.GetHeight();
+	if (!m_HasVisibility || width != m_KeptAO.GetWidth() || height != m_KeptAO.GetHeight())
+	{
+		std::cerr << "No incremental render of a " << width << "x" << height << " frame to relight" << std::endl;
+		return false;
+	}
+	if (!MatchesFrame(outputs, width, height))
+	{
+		std::cerr << "Render buffers don't match the " << width << "x" << height << " frame" << std::endl;
+		return false;
 	}
 
-	Mat4x4 MShadow = Viewport * Projection * ModelView;
+	m_Width = width;
+	m_Height = height;
+	TGAImage* shadow = outputs.ShadowMap;
+	if (shadow)
+		shadow->Clear();
+	else
+		shadow = &m_Targets->AcquireImage(width, height, 1);
+	DepthBuffer& shadowDepth = m_Targets->AcquireDepth(width, height, m_ShadowMapFormat);
+	PassBuffers buffers{ &m_KeptAO, shadow, nullptr, &shadowDepth, nullptr };
 
+	Mat4x4 MShadow = RenderShadowMap(buffers, m_VisibilityCamera, lightDir);
 	{
-		std::clog << "Rendering Final Image..." << std::endl;
+		NANOGL_PROFILE_SCOPE(ProfilePass::FinalShading);
+		SetCamera(m_VisibilityCamera);
+		Shader shader = CreateShader(MShadow, lightDir, buffers);
+		ShadeVisibility(shader, frame);
+	}
+
+	// The kept AO is copied row by row like it was kept, pixels are only converted for an output of another format
+	TGAImage* AO = outputs.AmbientOcclusion;
+	if (AO && AO->GetBytesPerPixel() == m_KeptAO.GetBytesPerPixel())
+	{
+		for (int y = 0; y < height; y++)
+			memcpy(AO->GetRow(y), m_KeptAO.GetRow(y), (size_t)width * m_KeptAO.GetBytesPerPixel());
+	}
+	else if (AO)
+	{
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+				AO->SetPixel(x, y, m_KeptAO.GetPixel(x, y));
+		}
+	}
+	if (shadow != outputs.ShadowMap)
+		m_Targets->Release(*shadow);
+	m_Targets->Release(shadowDepth);
+	return true;
+}
+
+// Sorts the meshlets of every instance the current matrices can show into the tiles their projected bounds overlap
+void ModelRenderer::BinMeshlets(int width, int height, int tileSize, std::vector<std::vector<BinnedMeshlet>>& bins) const
+{
+	int tilesX = (width + tileSize - 1) / tileSize, tilesY = (height + tileSize - 1) / tileSize;
+	bins.assign((size_t)tilesX * tilesY, std::vector<BinnedMeshlet>());
 
-		LookAt(eye, center, up);
-		CreateViewportMatrix(m_Width / 8, m_Height / 8, m_Width * 3 / 4, m_Height * 3 / 4);
-		CreateProjectionMatrix(-1.0f / (eye - center).Magnitude());
+	Mat4x4 view = ModelView;
+	int instanceCount = std::max(1, (int)m_Instances.size());
+	for (int instance = 0; instance < instanceCount; instance++)
+	{
+		bool mirrored = SetInstance(instance, view);
+		BinInstance(instance, mirrored, width, height, tileSize, bins);
+	}
+	ModelView = view;
+}
+
+void ModelRenderer::BinInstance(int instance, bool mirrored, int width, int height, int tileSize, std::vector<std::vector<BinnedMeshlet>>& bins) const
+{
+	int tilesX = (width + tileSize - 1) / tileSize, tilesY = (height + tileSize - 1) / tileSize;
+	const std::vector<BVHNode>& bvh = m_Model->GetBVH();
+	const std::vector<Meshlet>& meshlets = m_Model->GetMeshlets();
+	Mat4x4 transform = Viewport * Projection * ModelView;
+	Vec4f viewer = GetViewer();
+	for (const BVHNode& node : bvh)
+	{
+		if (node.RightChild >= 0)
+			continue;
+		const Meshlet& meshlet = meshlets[node.Meshlet];
+		if (TestMeshletCone(viewer, meshlet, mirrored))
+			continue;
+		if (TestBox(node.BoundsMin, node.BoundsMax, width, height) == Visibility::Outside)
+			continue;
 
-		Shader shader(Viewport*Projection*ModelView, (Viewport*Projection * ModelView).InvertTranspose(), MShadow * (Viewport * Projection * ModelView).Invert(), *m_Model, lightDir, m_ShadowBuffer, m_AOImage);
-		Vec4f screenCoords[3];
-		for (int i = 0; i < m_Model->nFaces(); i++)
+		// Bounds reaching behind the viewer project nowhere useful, they go to every tile
+		Vec2f boundsMin(0, 0), boundsMax((float)width, (float)height);
+		bool behind = false;
+		Vec2f screenMin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+		Vec2f screenMax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+		for (int corner = 0; corner < 8 && !behind; corner++)
 		{
-			for (int j = 0; j < 3; j++)
+			Vec3f p((corner & 1) ? node.BoundsMax.x : node.BoundsMin.x, (corner & 2) ? node.BoundsMax.y : node.BoundsMin.y, (corner & 4) ? node.BoundsMax.z : node.BoundsMin.z);
+			Vec4f clip = transform * Embed<4>(p);
+			behind = clip[3] <= 1e-6f;
+			for (int j = 0; j < 2 && !behind; j++)
 			{
-				screenCoords[j] = shader.Vertex(i, j);
+				screenMin[j] = std::min(screenMin[j], clip[j] / clip[3]);
+				screenMax[j] = std::max(screenMax[j], clip[j] / clip[3]);
 			}
-			Triangle(screenCoords, shader, frame, m_Zbuffer);
+		}
+		if (!behind)
+		{
+			boundsMin = screenMin;
+			boundsMax = screenMax;
 		}
 
+		// Clamped before the conversion, bounds close to the viewer's plane project very far out
+		int tx0 = (int)std::floor(std::max(boundsMin.x, 0.0f)) / tileSize, tx1 = std::min(tilesX - 1, (int)std::ceil(std::min(boundsMax.x, (float)width)) / tileSize);
+		int ty0 = (int)std::floor(std::max(boundsMin.y, 0.0f)) / tileSize, ty1 = std::min(tilesY - 1, (int)std::ceil(std::min(boundsMax.y, (float)height)) / tileSize);
+		for (int ty = ty0; ty <= ty1; ty++)
+		{
+			for (int tx = tx0; tx <= tx1; tx++)
+				bins[ty * tilesX + tx].push_back(BinnedMeshlet{ instance, node.Meshlet });
+		}
+	}
+}
+
+void ModelRenderer::RenderMeshlets(const std::vector<BinnedMeshlet>& meshlets, IShader& shader, TGAImage& target, DepthBuffer& depth)
+{
+	Mat4x4 view = ModelView;
+	int instance = -1;
+	for (const BinnedMeshlet& binned : meshlets)
+	{
+		if (binned.Instance != instance)
+		{
+			instance = binned.Instance;
+			SetInstance(instance, view);
+		}
+		const Meshlet& meshlet = m_Model->GetMeshlets()[binned.Meshlet];
+		RenderFaces(meshlet.FirstFace, meshlet.FaceCount, instance, shader, target, depth, nullptr);
+	}
+	ModelView = view;
+}
+
+bool ModelRenderer::RenderTiled(const char* filename, int width, int height, const Camera& camera, const Vec3f& lightDir, int tileSize)
+{
+	if (width <= 0 || height <= 0 || width > 65535 || height > 65535 || tileSize <= 0)
+	{
+		std::cerr << "Tiled renders need 1 to 65535 pixels a side and a positive tile size" << std::endl;
+		return false;
+	}
+	TGATileWriter writer;
+	if (!writer.Open(filename, (uint16_t)width, (uint16_t)height, 3))
+		return false;
+
+	// AO and shadow map of the whole frame. The final shader looks the AO image up by texture coordinates,
+	// so its size only changes its detail.
+	float scale = std::min(1.0f, (float)MaxTiledPassSize / std::max(width, height));
+	m_Width = std::max(1, (int)(width * scale));
+	m_Height = std::max(1, (int)(height * scale));
+	TGAImage& AO = m_Targets->AcquireImage(m_Width, m_Height, 3);
+	TGAImage& shadow = m_Targets->AcquireImage(m_Width, m_Height, 1);
+	DepthBuffer& AODepth = m_Targets->AcquireDepth(m_Width, m_Height);
+	DepthBuffer& shadowDepth = m_Targets->AcquireDepth(m_Width, m_Height, m_ShadowMapFormat);
+	PassBuffers buffers{ &AO, &shadow, &AODepth, &shadowDepth, nullptr };
+	{
+		std::clog << "Calculating Ambient Occlusion..." << std::endl;
+		SetCamera(camera);
+		ZShader zshader(*m_Model);
+		RenderPass(ProfilePass::AORaster, zshader, AO, AODepth);
+		ComputeAmbientOcclusion(AODepth, AO);
+		m_Targets->Release(AODepth);
 		std::clog << "DONE" << std::endl;
 	}
+	Mat4x4 MShadow = RenderShadowMap(buffers, camera, lightDir);
+
+	std::clog << "Rendering " << width << "x" << height << " in tiles of " << tileSize << "..." << std::endl;
+	m_Width = width;
+	m_Height = height;
+	SetCamera(camera);
+	std::vector<std::vector<BinnedMeshlet>> bins;
+	BinMeshlets(width, height, tileSize, bins);
+	Mat4x4 frameViewport = Viewport;
+
+	TGAImage& tile = m_Targets->AcquireImage(tileSize, tileSize, 3);
+	DepthBuffer& depth = m_Targets->AcquireDepth(tileSize, tileSize);
+	int tilesX = (width + tileSize - 1) / tileSize, tilesY = (height + tileSize - 1) / tileSize;
+	bool ok = true;
+	for (int ty = 0; ty < tilesY && ok; ty++)
+	{
+		for (int tx = 0; tx < tilesX && ok; tx++)
+		{
+			const std::vector<BinnedMeshlet>& bin = bins[ty * tilesX + tx];
+			tile.Clear();
+			depth.Clear();
+			if (!bin.empty())
+			{
+				// The tile's viewport is the frame's moved so that the tile's corner lands on the origin
+				Viewport = frameViewport;
+				Viewport[0][3] -= tx * tileSize;
+				Viewport[1][3] -= ty * tileSize;
+				{
+					NANOGL_PROFILE_SCOPE(ProfilePass::AORaster);
+					ZShader zshader(*m_Model);
+					RenderMeshlets(bin, zshader, tile, depth);
+				}
+				{
+					NANOGL_PROFILE_SCOPE(ProfilePass::FinalShading);
+					// The shader transforms the light with the viewport, it has to see the frame's for all tiles to match
+					Mat4x4 frameTransform = frameViewport * Projection * ModelView;
+					Shader shader(frameTransform, frameTransform.InvertTranspose(), MShadow * (Viewport * Projection * ModelView).Invert(), *m_Model, lightDir, buffers.ShadowDepth, buffers.AOImage, m_MathPrecision);
+					RenderMeshlets(bin, shader, tile, depth);
+				}
+			}
+			ok = writer.WriteRegion(tile, tx * tileSize, ty * tileSize);
+		}
+	}
+
+	m_Targets->Release(tile);
+	m_Targets->Release(depth);
+	m_Targets->Release(AO);
+	m_Targets->Release(shadow);
+	m_Targets->Release(shadowDepth);
+	ok = writer.Close() && ok;
+	std::clog << "DONE" << std::endl;
+	return ok;
+}
+
+bool ModelRenderer::HasLegacyBuffers(int width, int height) const
+{
+	if (!m_AOImage || !m_DepthImage || !m_Zbuffer || !m_ShadowBuffer)
+	{
+		std::cerr << "The renderer has no AO, depth and shadow buffers, render into memory with Render(frame, depth, camera, lightDir)" << std::endl;
+		return false;
+	}
+	if (m_AOImage->GetWidth() != width || m_AOImage->GetHeight() != height || m_DepthImage->GetWidth() != width || m_DepthImage->GetHeight() != height)
+	{
+		std::cerr << "Render buffers don't match the " << width << "x" << height << " frame" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void ModelRenderer::Render(TGAImage& frame, const Vec3f& eye, const Vec3f& center, const Vec3f& up, const Vec3f& lightDir)
+{
+	if (!HasLegacyBuffers(frame.GetWidth(), frame.GetHeight()))
+		return;
+	DepthBuffer depth(m_Zbuffer, frame.GetWidth(), frame.GetHeight()), shadowDepth(m_ShadowBuffer, frame.GetWidth(), frame.GetHeight());
+	RenderFrame(frame, PassBuffers{ m_AOImage, m_DepthImage, &depth, &shadowDepth, nullptr }, Camera{ eye, center, up }, lightDir);
+}
+
+void ModelRenderer::Render(MultisampleImage& frame, const Vec3f& eye, const Vec3f& center, const Vec3f& up, const Vec3f& lightDir)
+{
+	if (!HasLegacyBuffers(frame.GetWidth(), frame.GetHeight()))
+		return;
+	DepthBuffer depth(m_Zbuffer, frame.GetWidth(), frame.GetHeight()), shadowDepth(m_ShadowBuffer, frame.GetWidth(), frame.GetHeight());
+	RenderFrame(frame, PassBuffers{ m_AOImage, m_DepthImage, &depth, &shadowDepth, nullptr }, Camera{ eye, center, up }, lightDir);
+}
+
+bool ModelRenderer::Render(TGAImage& frame, float* depth, const Camera& camera, const Vec3f& lightDir, const RenderOutputs& outputs)
+{
+	DepthBuffer depthView(depth, frame.GetWidth(), frame.GetHeight());
+	return depth && RenderToMemory(frame, depthView, camera, lightDir, outputs);
+}
+
+bool ModelRenderer::Render(MultisampleImage& frame, float* depth, const Camera& camera, const Vec3f& lightDir, const RenderOutputs& outputs)
+{
+	DepthBuffer depthView(depth, frame.GetWidth(), frame.GetHeight());
+	return depth && RenderToMemory(frame, depthView, camera, lightDir, outputs);
+}
+
+bool ModelRenderer::Render(TGAImage& frame, DepthBuffer& depth, const Camera& camera, const Vec3f& lightDir, const RenderOutputs& outputs)
+{
+	return RenderToMemory(frame, depth, camera, lightDir, outputs);
+}
+
+bool ModelRenderer::Render(MultisampleImage& frame, DepthBuffer& depth, const Camera& camera, const Vec3f& lightDir, const RenderOutputs& outputs)
+{
+	return RenderToMemory(frame, depth, camera, lightDir, outputs);
 }
@@ -3,19 +3,149 @@
 #include "nanogl.h"
 #include "model.h"
 #include "tgaimage.h"
+#include "multisample.h"
 #include "shaders.h"
+#include "profiler.h"
+#include "rendertargets.h"
+
+#include <limits>
+#include <vector>
+
+struct Camera
+{
+	Vec3f Eye, Center, Up;
+};
+
+// Intermediate images a render hands back when they are set, they must have the size of the frame.
+// The ambient occlusion image needs 3 or 4 bytes per pixel.
+struct RenderOutputs
+{
+	TGAImage* AmbientOcclusion = nullptr;
+	TGAImage* ShadowMap = nullptr;
+};
 
 class ModelRenderer
 {
 public:
 	ModelRenderer(const char* filenamme, TGAImage* AOImage, TGAImage* depthImage, float* zbuffer, float* shadowbuffer);
+	// Same with a model loaded by the caller, for example with Model::LoadAsync()
+	ModelRenderer(const Model& model, TGAImage* AOImage, TGAImage* depthImage, float* zbuffer, float* shadowbuffer);
+	// Renders a model owned by the caller. Intermediate buffers come from targets, or from a pool of the renderer
+	// when it is null, and are reused between frames.
+	explicit ModelRenderer(const Model& model, RenderTargetPool* targets = nullptr);
 	~ModelRenderer();
+
+	ModelRenderer(const ModelRenderer&) = delete;
+	ModelRenderer& operator=(const ModelRenderer&) = delete;
 	
+	// Renders with the buffers given to the constructor, which need the frame's size. Renderers of a caller-owned model
+	// built without them log an error and draw nothing.
 	void Render(TGAImage& frame, const Vec3f& eye, const Vec3f& center, const Vec3f& up, const Vec3f& lightDir);
+	// The final pass is multisampled, ambient occlusion and shadows are computed at one sample per pixel
+	void Render(MultisampleImage& frame, const Vec3f& eye, const Vec3f& center, const Vec3f& up, const Vec3f& lightDir);
+
+	// Renders into caller-owned memory without touching any file. frame may wrap external memory.
+	// depth holds one float per pixel and is tested as is, fill it with -std::numeric_limits<float>::max() for a new frame.
+	// Returns false when the buffer sizes don't match.
+	bool Render(TGAImage& frame, float* depth, const Camera& camera, const Vec3f& lightDir, const RenderOutputs& outputs = RenderOutputs());
+	bool Render(MultisampleImage& frame, float* depth, const Camera& camera, const Vec3f& lightDir, const RenderOutputs& outputs = RenderOutputs());
+	// Same with a depth buffer of any format, Clear() it for a new frame
+	bool Render(TGAImage& frame, DepthBuffer& depth, const Camera& camera, const Vec3f& lightDir, const RenderOutputs& outputs = RenderOutputs());
+	bool Render(MultisampleImage& frame, DepthBuffer& depth, const Camera& camera, const Vec3f& lightDir, const RenderOutputs& outputs = RenderOutputs());
+
+	// Depth format of the shadow map of in-memory renders
+	void SetShadowMapFormat(DepthFormat format) { m_ShadowMapFormat = format; }
+	// Accuracy of the math in the AO sweep and the final shading, see fastmath.h for the error bounds
+	void SetMathPrecision(MathPrecision precision) { m_MathPrecision = precision; }
+
+	// Triangles and clusters submitted, culled and rasterized by the pass of the last render that ran it
+	const RasterStats& GetPassStats(ProfilePass pass) const { return m_PassStats[(int)pass]; }
+
+	// Faces are drawn from both sides by default, culling back faces is only safe for closed meshes
+	void SetCullMode(CullMode mode, Winding frontFace = Winding::CounterClockwise) { m_CullMode = mode; m_FrontFace = frontFace; }
+
+	// Draws the model once per object to world transform in every pass, all instances share the mesh, its BVH and the
+	// textures and each one is culled on its own. Without instances the model is drawn once as it is.
+	// Relight() needs a full render after the instances changed.
+	void SetInstances(std::vector<Mat4x4> instances) { m_Instances = std::move(instances); m_HasVisibility = false; }
+
+	// In incremental mode in-memory renders into a TGAImage keep the face and barycentrics of every pixel and the AO image,
+	// 23 bytes per pixel, so that Relight() can redo just the light dependent work
+	void SetIncremental(bool incremental) { m_Incremental = incremental; }
+	// Renders the last incremental render again with another light: only the shadow map is rebuilt and the visible pixels
+	// are shaded again, the AO pass and the camera rasterization are reused. frame must hold that render, pixels no face
+	// covers are left as they are. Returns false when there is no incremental render of the frame's size.
+	bool Relight(TGAImage& frame, const Vec3f& lightDir, const RenderOutputs& outputs = RenderOutputs());
+
+	// Largest side of the AO image and shadow map of tiled renders
+	static const int MaxTiledPassSize = 1024;
+	// Renders a frame of up to 65535x65535 pixels straight into an uncompressed TGA file, tile by tile. Every tile has
+	// its own viewport, depth buffer and depth prepass and only rasterizes the meshlets binned to it, so memory is bounded
+	// by the tile size. AO and the shadow map are rendered once for the whole frame at no more than MaxTiledPassSize
+	// pixels a side and have the detail of a render of that size. Returns false when the file can't be written.
+	bool RenderTiled(const char* filename, int width, int height, const Camera& camera, const Vec3f& lightDir, int tileSize = 256);
 private:
-	Model* m_Model;
-	TGAImage* m_AOImage, *m_DepthImage;
-	int m_Width, m_Height;
-	float* m_Zbuffer;
-	float* m_ShadowBuffer;
+	struct PassBuffers
+	{
+		TGAImage* AOImage;
+		TGAImage* ShadowImage;
+		DepthBuffer* Depth;
+		DepthBuffer* ShadowDepth;
+		VisibilitySample* Visibility;	// Recorded by the final pass when set
+	};
+
+	struct BinnedMeshlet
+	{
+		int Instance;
+		int Meshlet;
+	};
+
+	template<typename Target> void RenderFrame(Target& frame, const PassBuffers& buffers, const Camera& camera, const Vec3f& lightDir);
+	void SetCamera(const Camera& camera);
+	// Returns the transform from camera screen coordinates to shadow map coordinates
+	Mat4x4 RenderShadowMap(const PassBuffers& buffers, const Camera& camera, const Vec3f& lightDir);
+	Shader CreateShader(const Mat4x4& MShadow, const Vec3f& lightDir, const PassBuffers& buffers) const;
+	bool MatchesFrame(const RenderOutputs& outputs, int width, int height) const;
+	bool HasLegacyBuffers(int width, int height) const;
+	void KeepVisibility(const Camera& camera, const TGAImage& AOImage);
+	void ShadeVisibility(IShader& shader, TGAImage& frame) const;
+	void BinMeshlets(int width, int height, int tileSize, std::vector<std::vector<BinnedMeshlet>>& bins) const;
+	void BinInstance(int instance, bool mirrored, int width, int height, int tileSize, std::vector<std::vector<BinnedMeshlet>>& bins) const;
+	void RenderMeshlets(const std::vector<BinnedMeshlet>& meshlets, IShader& shader, TGAImage& target, DepthBuffer& depth);
+	template<typename Target> bool RenderToMemory(Target& frame, DepthBuffer& depth, const Camera& camera, const Vec3f& lightDir, const RenderOutputs& outputs);
+	void ComputeAmbientOcclusion(DepthBuffer& depth, TGAImage& AOImage);
+	template<typename DepthView> void ComputeAmbientOcclusion(const DepthView& depth, TGAImage& AOImage);
+	template<MathPrecision P, typename DepthView> void ComputeAmbientOcclusion(const DepthView& depth, TGAImage& AOImage);
+	template<typename Target> void RenderPass(ProfilePass pass, IShader& shader, Target& target, DepthBuffer& depth, VisibilitySample* visibility = nullptr);
+	template<typename Target> void RenderInstance(int instance, bool mirrored, IShader& shader, Target& target, DepthBuffer& depth, VisibilitySample* visibility);
+	template<typename Target> void RenderFaces(int first, int count, int instance, IShader& shader, Target& target, DepthBuffer& depth, VisibilitySample* visibility);
+	// Appends the instance's transform to view in ModelView and sets the cull mode for it, returns whether it mirrors
+	bool SetInstance(int instance, const Mat4x4& view) const;
+private:
+	const Model* m_Model;
+	Model* m_OwnedModel = nullptr;
+	TGAImage* m_AOImage = nullptr, *m_DepthImage = nullptr;
+	int m_Width = 0, m_Height = 0;
+	float* m_Zbuffer = nullptr;
+	float* m_ShadowBuffer = nullptr;
+
+	// Intermediate buffers of in-memory renders
+	RenderTargetPool m_OwnTargets;
+	RenderTargetPool* m_Targets = &m_OwnTargets;
+	DepthFormat m_ShadowMapFormat = DepthFormat::Float32;
+	MathPrecision m_MathPrecision = MathPrecision::Exact;
+	CullMode m_CullMode = CullMode::None;
+	RasterStats m_PassStats[(int)ProfilePass::Count];
+	Winding m_FrontFace = Winding::CounterClockwise;
+	std::vector<Mat4x4> m_Instances;
+
+	// Kept by incremental renders for Relight()
+	bool m_Incremental = false;
+	bool m_HasVisibility = false;
+	Camera m_VisibilityCamera;
+	std::vector<VisibilitySample> m_Visibility;
+	std::vector<int> m_ShadeOrder;		// Covered pixels grouped by face, and by instance within a face
+	std::vector<int> m_FaceOffsets;		// Start of each face's pixels in m_ShadeOrder
+	std::vector<int> m_CoveredPixels;
+	TGAImage m_KeptAO;
 };
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include "blockcompression.h"
+
+// Squared distance of two BGRA colors, alpha ignored
+static int ColorDistance(uint32_t a, uint32_t b)
+{
+	int distance = 0;
+	for (int shift = 0; shift < 24; shift += 8)
+	{
+		int d = (int)((a >> shift) & 0xff) - (int)((b >> shift) & 0xff);
+		distance += d * d;
+	}
+	return distance;
+}
+
+static uint32_t QuantizeRGB565(const float color[3])
+{
+	uint32_t r = (uint32_t)std::min(std::max(color[0] * 31.0f / 255.0f + 0.5f, 0.0f), 31.0f);
+	uint32_t g = (uint32_t)std::min(std::max(color[1] * 63.0f / 255.0f + 0.5f, 0.0f), 63.0f);
+	uint32_t b = (uint32_t)std::min(std::max(color[2] * 31.0f / 255.0f + 0.5f, 0.0f), 31.0f);
+	return (r << 11) | (g << 5) | b;
+}
+
+// Picks the closest palette entry for every texel, returns the block and its squared error
+static uint64_t BuildBC1Block(uint32_t c0, uint32_t c1, const uint32_t texels[16], int& error)
+{
+	if (c0 < c1)
+		std::swap(c0, c1);
+	uint64_t block = c0 | (c1 << 16);
+	uint32_t palette[4];
+	for (int i = 0; i < 4; i++)
+		palette[i] = DecodeBC1(block | ((uint64_t)i << 32), 0);
+
+	error = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0, bestDistance = ColorDistance(texels[i], palette[0]);
+		for (int p = 1; p < (c0 == c1 ? 1 : 4); p++)
+		{
+			int distance = ColorDistance(texels[i], palette[p]);
+			if (distance < bestDistance)
+			{
+				best = p;
+				bestDistance = distance;
+			}
+		}
+		block |= (uint64_t)best << (32 + 2 * i);
+		error += bestDistance;
+	}
+	return block;
+}
+
+uint64_t EncodeBC1(const uint32_t texels[16])
+{
+	// RGB as floats, red first
+	float colors[16][3], mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			colors[i][c] = (float)((texels[i] >> (16 - 8 * c)) & 0xff);
+			mean[c] += colors[i][c] / 16;
+		}
+	}
+
+	// Principal axis of the colors by power iteration on their covariance
+	float covariance[3][3] = {};
+	for (int i = 0; i < 16; i++)
+		for (int a = 0; a < 3; a++)
+			for (int b = 0; b < 3; b++)
+				covariance[a][b] += (colors[i][a] - mean[a]) * (colors[i][b] - mean[b]);
+	// Starting from the row of the channel that varies most, the start is never orthogonal to the axis
+	int widest = covariance[1][1] > covariance[0][0] ? 1 : 0;
+	widest = covariance[2][2] > covariance[widest][widest] ? 2 : widest;
+	float axis[3] = { covariance[widest][0], covariance[widest][1], covariance[widest][2] };
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[3];
+		for (int a = 0; a < 3; a++)
+			next[a] = covariance[a][0] * axis[0] + covariance[a][1] * axis[1] + covariance[a][2] * axis[2];
+		float length = std::max(std::abs(next[0]), std::max(std::abs(next[1]), std::abs(next[2])));
+		if (length < 1e-6f)
+			break;
+		for (int a = 0; a < 3; a++)
+			axis[a] = next[a] / length;
+	}
+
+	// The texels farthest apart along the axis are the first endpoints
+	int minIndex = 0, maxIndex = 0;
+	float minProjection = 1e30f, maxProjection = -1e30f;
+	for (int i = 0; i < 16; i++)
+	{
+		float projection = colors[i][0] * axis[0] + colors[i][1] * axis[1] + colors[i][2] * axis[2];
+		if (projection < minProjection) { minProjection = projection; minIndex = i; }
+		if (projection > maxProjection) { maxProjection = projection; maxIndex = i; }
+	}
+	int error;
+	uint64_t block = BuildBC1Block(QuantizeRGB565(colors[maxIndex]), QuantizeRGB565(colors[minIndex]), texels, error);
+
+	// Least squares endpoints for the chosen indices, kept when they lower the error
+	static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	float aa = 0, ab = 0, bb = 0, ax[3] = {}, bx[3] = {};
+	for (int i = 0; i < 16; i++)
+	{
+		float a = weights[(block >> (32 + 2 * i)) & 3], b = 1.0f - a;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < 3; c++)
+		{
+			ax[c] += a * colors[i][c];
+			bx[c] += b * colors[i][c];
+		}
+	}
+	float determinant = aa * bb - ab * ab;
+	if (std::abs(determinant) > 1e-6f)
+	{
+		float e0[3], e1[3];
+		for (int c = 0; c < 3; c++)
+		{
+			e0[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+			e1[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+		}
+		int refinedError;
+		uint64_t refined = BuildBC1Block(QuantizeRGB565(e0), QuantizeRGB565(e1), texels, refinedError);
+		if (refinedError < error)
+			block = refined;
+	}
+	return block;
+}
+
+uint64_t EncodeBC4(const uint32_t texels[16], int channel)
+{
+	uint8_t values[16];
+	uint8_t minValue = 255, maxValue = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		values[i] = (uint8_t)(texels[i] >> (8 * channel));
+		minValue = std::min(minValue, values[i]);
+		maxValue = std::max(maxValue, values[i]);
+	}
+
+	// Endpoints in descending order select the 8 value palette, equal ones leave every index at 0
+	uint64_t block = maxValue | (minValue << 8);
+	if (minValue == maxValue)
+		return block;
+	uint8_t palette[8];
+	for (int i = 0; i < 8; i++)
+		palette[i] = DecodeBC4(block | ((uint64_t)i << 16), 0);
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0;
+		for (int p = 1; p < 8; p++)
+		{
+			if (std::abs(values[i] - palette[p]) < std::abs(values[i] - palette[best]))
+				best = p;
+		}
+		block |= (uint64_t)best << (16 + 3 * i);
+	}
+	return block;
+}
\ No newline at end of file
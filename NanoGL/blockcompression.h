@@ -0,0 +1,67 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Block compression of 4x4 texels with the bit layouts of the D3D BC formats.
+// Texels are numbered row by row within a block, the encoders take them as BGRA (TGAColor) values.
+//  BC1: two RGB565 endpoints and 2-bit indices into 4 colors, 8 bytes per block. Alpha is not kept and decodes as 255.
+//  BC4: two 8-bit endpoints and 3-bit indices into 8 values, 8 bytes per block, for one channel.
+//  BC5: two BC4 blocks, used for the red and green channels of tangent space normal maps.
+
+uint64_t EncodeBC1(const uint32_t texels[16]);
+// Compresses one channel, the byte index into the BGRA value
+uint64_t EncodeBC4(const uint32_t texels[16], int channel);
+
+inline uint32_t ExpandRGB565(uint32_t c)
+{
+	uint32_t r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	return ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+}
+
+// BGRA value of texel i
+inline uint32_t DecodeBC1(uint64_t block, int i)
+{
+	uint32_t c0 = (uint32_t)block & 0xffff, c1 = (uint32_t)(block >> 16) & 0xffff;
+	uint32_t index = (uint32_t)(block >> (32 + 2 * i)) & 3;
+	uint32_t e0 = ExpandRGB565(c0), e1 = ExpandRGB565(c1);
+	if (index < 2)
+		return (index ? e1 : e0) | 0xff000000;
+
+	uint32_t color = 0xff000000;
+	for (int shift = 0; shift < 24; shift += 8)
+	{
+		uint32_t a = (e0 >> shift) & 0xff, b = (e1 >> shift) & 0xff;
+		uint32_t v;
+		if (c0 > c1)
+			v = index == 2 ? (2 * a + b + 1) / 3 : (a + 2 * b + 1) / 3;
+		else
+			v = index == 2 ? (a + b) / 2 : 0;
+		color |= v << shift;
+	}
+	return color;
+}
+
+inline uint8_t DecodeBC4(uint64_t block, int i)
+{
+	uint32_t a0 = (uint32_t)block & 0xff, a1 = (uint32_t)(block >> 8) & 0xff;
+	uint32_t index = (uint32_t)(block >> (16 + 3 * i)) & 7;
+	if (index < 2)
+		return (uint8_t)(index ? a1 : a0);
+	if (a0 > a1)
+		return (uint8_t)(((8 - index) * a0 + (index - 1) * a1 + 3) / 7);
+	if (index >= 6)
+		return index == 6 ? 0 : 255;
+	return (uint8_t)(((6 - index) * a0 + (index - 1) * a1 + 2) / 5);
+}
+
+// BGRA value of texel i of a tangent space normal map, blue is rebuilt so that the normal has unit length
+inline uint32_t DecodeBC5Normal(const uint64_t block[2], int i)
+{
+	uint32_t r = DecodeBC4(block[0], i), g = DecodeBC4(block[1], i);
+	float x = r / 127.5f - 1.0f, y = g / 127.5f - 1.0f;
+	float z = std::sqrt(std::max(1.0f - x * x - y * y, 0.0f));
+	uint32_t b = (uint32_t)std::min(z * 127.5f + 128.0f, 255.0f);
+	return 0xff000000 | (r << 16) | (g << 8) | b;
+}
\ No newline at end of file
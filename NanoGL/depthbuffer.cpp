@@ -0,0 +1,115 @@
+#include "depthbuffer.h"
+
+#include <algorithm>
+
+#include "geometry.h"
+
+void FillDepth(float* data, size_t count, float value)
+{
+#ifdef NANOGL_SSE
+	size_t i = 0;
+	for (; i < count && ((uintptr_t)(data + i) & 15); i++)
+		data[i] = value;
+	__m128 v = _mm_set1_ps(value);
+	for (; i + 16 <= count; i += 16)
+	{
+		_mm_store_ps(data + i, v);
+		_mm_store_ps(data + i + 4, v);
+		_mm_store_ps(data + i + 8, v);
+		_mm_store_ps(data + i + 12, v);
+	}
+	for (; i + 4 <= count; i += 4)
+		_mm_store_ps(data + i, v);
+	for (; i < count; i++)
+		data[i] = value;
+#else
+	std::fill(data, data + count, value);
+#endif
+}
+
+constexpr float DepthBuffer::DefaultRange;
+
+DepthBuffer::DepthBuffer(int width, int height, DepthFormat format, float range)
+	: m_Width(width), m_Height(height), m_TilesX((width + TileSize - 1) / TileSize), m_TilesY((height + TileSize - 1) / TileSize), m_Format(format), m_Range(range)
+{
+	if (format != DepthFormat::Float32)
+	{
+		m_Max = format == DepthFormat::Unorm16 ? 65535.0f : 16777215.0f;
+		m_Scale = m_Max / (2 * range);
+	}
+
+	const size_t alignment = 64;
+	m_Storage.reset(new uint8_t[(size_t)width * height * GetBytesPerPixel() + alignment - 1]);
+	m_Data = (void*)(((uintptr_t)m_Storage.get() + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	m_Cleared.resize((size_t)m_TilesX * m_TilesY);
+	Clear();
+}
+
+DepthBuffer::DepthBuffer(float* data, int width, int height)
+	: m_Width(width), m_Height(height), m_TilesX((width + TileSize - 1) / TileSize), m_TilesY((height + TileSize - 1) / TileSize), m_Data(data)
+{
+}
+
+void DepthBuffer::Clear(float depth)
+{
+	m_Cleared.assign((size_t)m_TilesX * m_TilesY, 1);
+	m_ClearedTiles = m_TilesX * m_TilesY;
+	m_ClearDepth = depth;
+	if (m_Format == DepthFormat::Unorm24)
+		m_ClearDepth = GetUnorm24View().Decode(m_ClearValue = GetUnorm24View().Encode(depth));
+	else if (m_Format == DepthFormat::Unorm16)
+		m_ClearDepth = GetUnorm16View().Decode(m_ClearValue = GetUnorm16View().Encode(depth));
+}
+
+void DepthBuffer::FillTile(int tx, int ty)
+{
+	int x0 = tx * TileSize, y0 = ty * TileSize;
+	int w = std::min(TileSize, m_Width - x0), h = std::min(TileSize, m_Height - y0);
+	for (int y = y0; y < y0 + h; y++)
+	{
+		size_t row = x0 + (size_t)y * m_Width;
+		switch (m_Format)
+		{
+		case DepthFormat::Unorm24: std::fill_n((uint32_t*)m_Data + row, w, m_ClearValue); break;
+		case DepthFormat::Unorm16: std::fill_n((uint16_t*)m_Data + row, w, (uint16_t)m_ClearValue); break;
+		default: FillDepth((float*)m_Data + row, w, m_ClearDepth); break;
+		}
+	}
+	m_Cleared[ty * m_TilesX + tx] = 0;
+	m_ClearedTiles--;
+}
+
+void DepthBuffer::Touch(int x0, int y0, int x1, int y1)
+{
+	if (!m_ClearedTiles)
+		return;
+	int tx0 = std::max(x0, 0) / TileSize, ty0 = std::max(y0, 0) / TileSize;
+	int tx1 = std::min(x1, m_Width - 1) / TileSize, ty1 = std::min(y1, m_Height - 1) / TileSize;
+	for (int ty = ty0; ty <= ty1; ty++)
+	{
+		for (int tx = tx0; tx <= tx1; tx++)
+		{
+			if (m_Cleared[ty * m_TilesX + tx])
+				FillTile(tx, ty);
+		}
+	}
+}
+
+void DepthBuffer::Resolve()
+{
+	if (m_Format == DepthFormat::Float32 && m_ClearedTiles == m_TilesX * m_TilesY)
+	{
+		// Nothing was drawn, one contiguous fill is faster than tile by tile
+		FillDepth((float*)m_Data, (size_t)m_Width * m_Height, m_ClearDepth);
+		std::fill(m_Cleared.begin(), m_Cleared.end(), 0);
+		m_ClearedTiles = 0;
+	}
+	Touch(0, 0, m_Width - 1, m_Height - 1);
+}
+
+float* DepthBuffer::GetData()
+{
+	assert(m_Format == DepthFormat::Float32);
+	Resolve();
+	return (float*)m_Data;
+}
\ No newline at end of file
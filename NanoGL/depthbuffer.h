@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+// Fills count floats, vectorized where SSE is available
+void FillDepth(float* data, size_t count, float value);
+
+// Storage of a depth value. The unorm formats map the clip space z range [-range, range] linearly to integers
+// and are compared as integers, bigger is closer like the float depth.
+//  Float32: exact, 4 bytes per pixel.
+//  Unorm24: steps of 2 * range / 2^24 (2.4e-7 for the default range, about a float's spacing near 1),
+//           stored in the low bits of 4 bytes like a D24X8 buffer, so it saves no memory over Float32.
+//  Unorm16: steps of 2 * range / 2^16 (6.1e-5 for the default range), 2 bytes per pixel. Surfaces closer together
+//           than a step tie and the later one wins, shadow maps need a bias of at least one step.
+// Depths outside the range are clamped, which makes everything beyond it tie as well.
+enum class DepthFormat { Float32, Unorm24, Unorm16 };
+
+// Typed views of depth memory for the rasterizer, Encode() turns a fragment depth into the stored value
+struct FloatDepthView
+{
+	float* Data;
+
+	float Encode(float z) const { return z; }
+	float Decode(float v) const { return v; }
+	bool IsEmpty(size_t i) const { return Data[i] < -1e5f; }
+};
+
+template<typename T>
+struct UnormDepthView
+{
+	T* Data;
+	float Range, Scale, Max;
+
+	// Clamped again after rounding, Max + 0.5 of Unorm24 rounds up to 2^24 in float
+	T Encode(float z) const { return (T)std::min((uint32_t)(std::min(std::max((z + Range) * Scale, 0.0f), Max) + 0.5f), (uint32_t)Max); }
+	float Decode(T v) const { return v / Scale - Range; }
+	bool IsEmpty(size_t i) const { return Data[i] == 0; }
+};
+
+// Depth target that is cleared lazily per tile.
+// Clear() only marks the tiles, a tile's memory is filled the first time the rasterizer touches it
+// and tiles nothing was drawn to are never written. GetDepth() answers reads of cleared tiles without touching memory.
+class DepthBuffer
+{
+public:
+	static const int TileSize = 32;
+	static constexpr float DefaultRange = 2.0f;	// Covers models normalized to the unit cube, seen from any side
+
+	DepthBuffer() = default;
+	DepthBuffer(int width, int height, DepthFormat format = DepthFormat::Float32, float range = DefaultRange);
+	// Wraps caller-owned depth values that are already valid, the memory must outlive the buffer
+	DepthBuffer(float* data, int width, int height);
+
+	DepthBuffer(const DepthBuffer&) = delete;
+	DepthBuffer& operator=(const DepthBuffer&) = delete;
+	DepthBuffer(DepthBuffer&&) = default;
+	DepthBuffer& operator=(DepthBuffer&&) = default;
+
+	void Clear(float depth = -std::numeric_limits<float>::max());
+
+	// Fills the cleared tiles overlapping the inclusive pixel rectangle, which is clipped to the buffer
+	void Touch(int x0, int y0, int x1, int y1);
+	// Fills every tile that is still cleared, the whole buffer is valid in memory afterwards
+	void Resolve();
+	// Resolved float depth, Float32 buffers only
+	float* GetData();
+
+	// Memory as is, values in cleared tiles are stale
+	FloatDepthView GetFloatView() const { assert(m_Format == DepthFormat::Float32); return FloatDepthView{ (float*)m_Data }; }
+	UnormDepthView<uint32_t> GetUnorm24View() const { assert(m_Format == DepthFormat::Unorm24); return UnormDepthView<uint32_t>{ (uint32_t*)m_Data, m_Range, m_Scale, m_Max }; }
+	UnormDepthView<uint16_t> GetUnorm16View() const { assert(m_Format == DepthFormat::Unorm16); return UnormDepthView<uint16_t>{ (uint16_t*)m_Data, m_Range, m_Scale, m_Max }; }
+
+	float GetDepth(int x, int y) const
+	{
+		if (m_ClearedTiles && m_Cleared[(y / TileSize) * m_TilesX + x / TileSize])
+			return m_ClearDepth;
+		size_t i = x + (size_t)y * m_Width;
+		switch (m_Format)
+		{
+		case DepthFormat::Unorm24: return GetUnorm24View().Decode(((const uint32_t*)m_Data)[i]);
+		case DepthFormat::Unorm16: return GetUnorm16View().Decode(((const uint16_t*)m_Data)[i]);
+		default: return ((const float*)m_Data)[i];
+		}
+	}
+
+	bool IsTileCleared(int tx, int ty) const { return m_ClearedTiles && m_Cleared[ty * m_TilesX + tx]; }
+	DepthFormat GetFormat() const { return m_Format; }
+	int GetWidth() const { return m_Width; }
+	int GetHeight() const { return m_Height; }
+	int GetTilesX() const { return m_TilesX; }
+	int GetTilesY() const { return m_TilesY; }
+	size_t GetBytesPerPixel() const { return m_Format == DepthFormat::Unorm16 ? 2 : 4; }
+private:
+	void FillTile(int tx, int ty);
+private:
+	int m_Width = 0, m_Height = 0;
+	int m_TilesX = 0, m_TilesY = 0;
+	DepthFormat m_Format = DepthFormat::Float32;
+	float m_Range = DefaultRange, m_Scale = 1, m_Max = 0;	// Unorm encoding
+	void* m_Data = nullptr;
+	std::unique_ptr<uint8_t[]> m_Storage;	// Owned memory, m_Data is its 64-byte aligned start
+	std::vector<uint8_t> m_Cleared;			// One flag per tile
+	int m_ClearedTiles = 0;
+	float m_ClearDepth = -std::numeric_limits<float>::max();	// As GetDepth() returns it, decoded for unorm formats
+	uint32_t m_ClearValue = 0;	// Encoded clear depth of the unorm formats
+};
\ No newline at end of file
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "geometry.h"
+
+// Approximations of the libm functions used by the shading and AO hot paths.
+// They are branch free apart from the precision, which is a template argument, so loops calling them can be vectorized.
+// Worst case errors, measured by the benchmark's math/* entries:
+//            Medium                Fast
+//  Rsqrt     2.5e-7 relative       3.2e-4 relative      x in [1e-3, 1e3]
+//  Atan      3.9e-6 rad            1.5e-3 rad           x in [-20, 20]
+//  Log2      1.8e-6                6e-5                 x in [1e-3, 1e3]
+//  Exp2      1.6e-7 relative       1e-4 relative        x in [-20, 20]
+//  Pow       9.6e-5 relative       4e-3 relative        x^100, x in [0.5, 1]
+//  SinCos    8.4e-7                1.1e-5               x in [-20, 20]
+// Results are not clamped to the range of the exact function, Pow(1, y) for example can come out slightly above 1.
+// Rendered frames and AO images stay within 1 (Medium) and 8 (Fast) of the exact 8-bit values up to 512x512, see the
+// precision/* entries. The Fast error grows with the resolution as the AO horizon search takes more steps.
+enum class MathPrecision { Exact, Medium, Fast };
+
+inline float BitsToFloat(uint32_t i)
+{
+	float f;
+	memcpy(&f, &i, sizeof(f));
+	return f;
+}
+
+inline uint32_t FloatToBits(float f)
+{
+	uint32_t i;
+	memcpy(&i, &f, sizeof(i));
+	return i;
+}
+
+template<MathPrecision P>
+inline float FastRsqrt(float x)
+{
+	if (P == MathPrecision::Exact)
+		return 1.0f / std::sqrt(x);
+#ifdef NANOGL_SSE
+	float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+	if (P == MathPrecision::Fast)
+		return y;
+	return y * (1.5f - 0.5f * x * y * y);
+#else
+	float y = BitsToFloat(0x5f375a86 - (FloatToBits(x) >> 1));
+	y = y * (1.5f - 0.5f * x * y * y);
+	if (P == MathPrecision::Fast)
+		return y;
+	return y * (1.5f - 0.5f * x * y * y);
+#endif
+}
+
+template<MathPrecision P>
+inline float FastAtan(float x)
+{
+	if (P == MathPrecision::Exact)
+		return std::atan(x);
+
+	// atan(x) = pi/2 - atan(1/x) folds the argument into [-1, 1], where an odd polynomial fits
+	bool inverted = std::abs(x) > 1.0f;
+	float t = inverted ? 1.0f / x : x;
+	float s = t * t;
+	float r;
+	if (P == MathPrecision::Fast)
+		r = t * (0.999145994f + s * (-0.304440597f + s * 0.092156164f));
+	else
+		r = t * (0.999998017f + s * (-0.333060167f + s * (0.196054925f + s * (-0.122270664f + s * (0.0585597458f + s * -0.0138876237f)))));
+	float halfPi = x < 0 ? -1.57079633f : 1.57079633f;
+	return inverted ? halfPi - r : r;
+}
+
+// For x > 0
+template<MathPrecision P>
+inline float FastLog2(float x)
+{
+	if (P == MathPrecision::Exact)
+		return std::log2(x);
+
+	uint32_t bits = FloatToBits(x);
+	float exponent = (float)((int)(bits >> 23) - 127);
+	float u = BitsToFloat((bits & 0x007fffff) | 0x3f800000) - 1.0f;	// mantissa - 1, in [0, 1)
+	float p;
+	if (P == MathPrecision::Fast)
+		p = 1.44261568f + u * (-0.717063932f + u * (0.442274179f + u * (-0.227712644f + u * 0.059945587f)));
+	else
+		p = 1.44269326f + u * (-0.721162736f + u * (0.477705955f + u * (-0.339247871f + u * (0.215588716f + u * (-0.0960664085f + u * 0.0204903981f)))));
+	return exponent + u * p;
+}
+
+template<MathPrecision P>
+inline float FastExp2(float x)
+{
+	if (P == MathPrecision::Exact)
+		return std::exp2(x);
+
+	x = std::min(std::max(x, -126.0f), 127.0f);
+	float i = std::floor(x);
+	float f = x - i;
+	float p;
+	if (P == MathPrecision::Fast)
+		p = 0.999896691f + f * (0.696390547f + f * (0.224516344f + f * 0.0790857012f));
+	else
+		p = 0.999999896f + f * (0.69315462f + f * (0.240140773f + f * (0.0558632757f + f * (0.00894622231f + f * 0.00189510431f))));
+	return p * BitsToFloat((uint32_t)((int)i + 127) << 23);
+}
+
+// For x >= 0, pow(0, y) is 0
+template<MathPrecision P>
+inline float FastPow(float x, float y)
+{
+	if (P == MathPrecision::Exact)
+		return std::pow(x, y);
+	return x > 0 ? FastExp2<P>(y * FastLog2<P>(x)) : 0.0f;
+}
+
+template<MathPrecision P>
+inline void FastSinCos(float x, float& s, float& c)
+{
+	if (P == MathPrecision::Exact)
+	{
+		s = std::sin(x);
+		c = std::cos(x);
+		return;
+	}
+
+	// Reduce to [-pi/4, pi/4] and pick the quadrant
+	float q = std::floor(x * 0.636619772f + 0.5f);
+	float r = x - q * 1.57079637f + q * 4.37113883e-8f;
+	float r2 = r * r;
+	float sr, cr;
+	if (P == MathPrecision::Fast)
+	{
+		sr = r * (0.999998566f + r2 * (-0.166624762f + r2 * 0.00815157096f));
+		cr = 0.999990007f + r2 * (-0.499707783f + r2 * 0.0403979562f);
+	}
+	else
+	{
+		sr = r * (0.999999997f + r2 * (-0.166666507f + r2 * (0.00833203634f + r2 * -0.000195039641f)));
+		cr = 0.999999972f + r2 * (-0.499998566f + r2 * (0.0416550209f + r2 * -0.00135858441f));
+	}
+	int quadrant = (int)q & 3;
+	s = quadrant & 1 ? cr : sr;
+	c = quadrant & 1 ? sr : cr;
+	if (quadrant == 1 || quadrant == 2) c = -c;
+	if (quadrant >= 2) s = -s;
+}
+
+template<MathPrecision P>
+inline Vec3f FastNormalize(Vec3f v)
+{
+	if (P == MathPrecision::Exact)
+		return v.Normalize();
+	return v * FastRsqrt<P>(v * v);
+}
\ No newline at end of file
@@ -5,6 +5,16 @@
 #include <cassert>
 #include <iostream>
 
+#if !defined(NANOGL_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define NANOGL_SSE 1
+#include <emmintrin.h>
+#endif
+
+// Vec4f is stored in an __m128 only where heap allocations are 16-byte aligned by default
+#if defined(NANOGL_SSE) && (defined(_M_X64) || defined(__x86_64__))
+#define NANOGL_SSE_VEC4 1
+#endif
+
 #define M_PI 3.14159265359
 
 template<size_t DimCols, size_t DimRows, typename T> class Mat;
@@ -51,6 +61,24 @@ struct Vec<3, T>
 	T x, y, z;
 };
 
+#ifdef NANOGL_SSE_VEC4
+template <>
+struct alignas(16) Vec<4, float>
+{
+	Vec() : m_Simd(_mm_setzero_ps()) {}
+	explicit Vec(__m128 v) : m_Simd(v) {}
+	float& operator[] (const size_t i) { assert(i < 4); return m_Data[i]; }
+	const float& operator[] (const size_t i) const { assert(i < 4); return m_Data[i]; }
+	__m128 Simd() const { return m_Simd; }
+private:
+	union
+	{
+		__m128 m_Simd;
+		float m_Data[4];
+	};
+};
+#endif
+
 //---------------------------------------------------------------------------------------------------------------------
 
 template <size_t DIM, typename T>
@@ -89,6 +117,36 @@ Vec<DIM, T> operator/(Vec<DIM, T> lhs, const U& rhs)
 	return lhs;
 }
 
+#ifdef NANOGL_SSE_VEC4
+inline float operator*(const Vec<4, float>& lhs, const Vec<4, float>& rhs)
+{
+	__m128 p = _mm_mul_ps(lhs.Simd(), rhs.Simd());
+	p = _mm_add_ps(p, _mm_movehl_ps(p, p));
+	p = _mm_add_ss(p, _mm_shuffle_ps(p, p, 1));
+	return _mm_cvtss_f32(p);
+}
+
+inline Vec<4, float> operator+(const Vec<4, float>& lhs, const Vec<4, float>& rhs)
+{
+	return Vec<4, float>(_mm_add_ps(lhs.Simd(), rhs.Simd()));
+}
+
+inline Vec<4, float> operator-(const Vec<4, float>& lhs, const Vec<4, float>& rhs)
+{
+	return Vec<4, float>(_mm_sub_ps(lhs.Simd(), rhs.Simd()));
+}
+
+inline Vec<4, float> operator*(const Vec<4, float>& lhs, const float& rhs)
+{
+	return Vec<4, float>(_mm_mul_ps(lhs.Simd(), _mm_set1_ps(rhs)));
+}
+
+inline Vec<4, float> operator/(const Vec<4, float>& lhs, const float& rhs)
+{
+	return Vec<4, float>(_mm_div_ps(lhs.Simd(), _mm_set1_ps(rhs)));
+}
+#endif
+
 template <size_t LEN, size_t DIM, typename T>
 Vec<LEN, T> Embed(const Vec<DIM, T>& v, T fill = 1)
 {
@@ -146,6 +204,25 @@ struct DT<1, T>
 
 //---------------------------------------------------------------------------------------------------------------------
 
+// Generic inverse through the adjugate, small sizes are specialized with closed forms below
+template<size_t DIM, typename T>
+struct MI
+{
+	static Mat<DIM, DIM, T> InvertTranspose(const Mat<DIM, DIM, T>& src)
+	{
+		Mat<DIM, DIM, T> ret = src.Adjugate();
+		T tmp = ret[0] * src[0];
+		return ret / tmp;
+	}
+
+	static Mat<DIM, DIM, T> Invert(const Mat<DIM, DIM, T>& src)
+	{
+		return InvertTranspose(src).Transpose();
+	}
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+
 template<size_t DimRows, size_t DimCols, typename T>
 class Mat 
 {
@@ -212,20 +289,17 @@ public:
 		return ret;
 	}
 
-	Mat<DimRows, DimCols, T> InvertTranspose() 
+	Mat<DimRows, DimCols, T> InvertTranspose() const
 	{
-		Mat<DimRows, DimCols, T> ret = Adjugate();
-		T tmp = ret[0] * m_Rows[0];
-		return ret / tmp;
+		return MI<DimCols, T>::InvertTranspose(*this);
 	}
 
-
-	Mat<DimRows, DimCols, T> Invert()
+	Mat<DimRows, DimCols, T> Invert() const
 	{
-		return InvertTranspose().Transpose();
+		return MI<DimCols, T>::Invert(*this);
 	}
 
-	Mat<DimCols, DimRows, T> Transpose()
+	Mat<DimCols, DimRows, T> Transpose() const
 	{
 		Mat<DimCols, DimRows, T> ret;
 		for (size_t i = DimCols; i--; ret[i] = this->Col(i));
@@ -251,6 +325,20 @@ Vec<DimRows, T> operator*(const Mat<DimRows, DimCols, T>& lhs, const Vec<DimCols
 	return ret;
 }
 
+#ifdef NANOGL_SSE_VEC4
+// Multiply every row by the vector, then transpose so the four dot products can be summed vertically
+inline Vec<4, float> operator*(const Mat<4, 4, float>& lhs, const Vec<4, float>& rhs)
+{
+	__m128 v = rhs.Simd();
+	__m128 r0 = _mm_mul_ps(lhs[0].Simd(), v);
+	__m128 r1 = _mm_mul_ps(lhs[1].Simd(), v);
+	__m128 r2 = _mm_mul_ps(lhs[2].Simd(), v);
+	__m128 r3 = _mm_mul_ps(lhs[3].Simd(), v);
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	return Vec<4, float>(_mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3)));
+}
+#endif
+
 template<size_t R1, size_t C1, size_t C2, typename T>
 Mat<R1, C2, T> operator*(const Mat<R1, C1, T>& lhs, const Mat<C1, C2, T>& rhs) 
 {
@@ -267,6 +355,202 @@ Mat<DimCols, DimRows, T> operator/(Mat<DimRows, DimCols, T> lhs, const T& rhs)
 	return lhs;
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+
+// Rows of the cofactor matrix are cross products of the other two rows
+template<typename T>
+struct MI<3, T>
+{
+	static Mat<3, 3, T> InvertTranspose(const Mat<3, 3, T>& src)
+	{
+		Mat<3, 3, T> ret;
+		ret[0] = Cross(src[1], src[2]);
+		ret[1] = Cross(src[2], src[0]);
+		ret[2] = Cross(src[0], src[1]);
+		return ret / (ret[0] * src[0]);
+	}
+
+	static Mat<3, 3, T> Invert(const Mat<3, 3, T>& src)
+	{
+		return InvertTranspose(src).Transpose();
+	}
+};
+
+// Laplace expansion over 2x2 sub-determinants of the upper and lower row pairs
+template<typename T>
+struct MI<4, T>
+{
+	static Mat<4, 4, T> Adjugate(const Mat<4, 4, T>& a, T& det)
+	{
+		T s0 = a[0][0] * a[1][1] - a[0][1] * a[1][0];
+		T s1 = a[0][0] * a[1][2] - a[0][2] * a[1][0];
+		T s2 = a[0][0] * a[1][3] - a[0][3] * a[1][0];
+		T s3 = a[0][1] * a[1][2] - a[0][2] * a[1][1];
+		T s4 = a[0][1] * a[1][3] - a[0][3] * a[1][1];
+		T s5 = a[0][2] * a[1][3] - a[0][3] * a[1][2];
+
+		T c5 = a[2][2] * a[3][3] - a[2][3] * a[3][2];
+		T c4 = a[2][1] * a[3][3] - a[2][3] * a[3][1];
+		T c3 = a[2][1] * a[3][2] - a[2][2] * a[3][1];
+		T c2 = a[2][0] * a[3][3] - a[2][3] * a[3][0];
+		T c1 = a[2][0] * a[3][2] - a[2][2] * a[3][0];
+		T c0 = a[2][0] * a[3][1] - a[2][1] * a[3][0];
+
+		det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+
+		Mat<4, 4, T> b;
+		b[0][0] =  a[1][1] * c5 - a[1][2] * c4 + a[1][3] * c3;
+		b[0][1] = -a[0][1] * c5 + a[0][2] * c4 - a[0][3] * c3;
+		b[0][2] =  a[3][1] * s5 - a[3][2] * s4 + a[3][3] * s3;
+		b[0][3] = -a[2][1] * s5 + a[2][2] * s4 - a[2][3] * s3;
+		b[1][0] = -a[1][0] * c5 + a[1][2] * c2 - a[1][3] * c1;
+		b[1][1] =  a[0][0] * c5 - a[0][2] * c2 + a[0][3] * c1;
+		b[1][2] = -a[3][0] * s5 + a[3][2] * s2 - a[3][3] * s1;
+		b[1][3] =  a[2][0] * s5 - a[2][2] * s2 + a[2][3] * s1;
+		b[2][0] =  a[1][0] * c4 - a[1][1] * c2 + a[1][3] * c0;
+		b[2][1] = -a[0][0] * c4 + a[0][1] * c2 - a[0][3] * c0;
+		b[2][2] =  a[3][0] * s4 - a[3][1] * s2 + a[3][3] * s0;
+		b[2][3] = -a[2][0] * s4 + a[2][1] * s2 - a[2][3] * s0;
+		b[3][0] = -a[1][0] * c3 + a[1][1] * c1 - a[1][2] * c0;
+		b[3][1] =  a[0][0] * c3 - a[0][1] * c1 + a[0][2] * c0;
+		b[3][2] = -a[3][0] * s3 + a[3][1] * s1 - a[3][2] * s0;
+		b[3][3] =  a[2][0] * s3 - a[2][1] * s1 + a[2][2] * s0;
+		return b;
+	}
+
+	static Mat<4, 4, T> Invert(const Mat<4, 4, T>& src)
+	{
+		T det;
+		Mat<4, 4, T> ret = Adjugate(src, det);
+		return ret / det;
+	}
+
+	static Mat<4, 4, T> InvertTranspose(const Mat<4, 4, T>& src)
+	{
+		return Invert(src).Transpose();
+	}
+};
+
+// Inverse of a matrix whose last row is (0, 0, 0, 1), like the viewport and view matrices
+template<typename T>
+Mat<4, 4, T> InvertAffine(const Mat<4, 4, T>& src)
+{
+	Mat<3, 3, T> linear;
+	for (size_t i = 3; i--; linear[i] = Proj<3>(src[i]));
+	Mat<3, 3, T> inv = linear.Invert();
+	Vec<3, T> t = inv * Proj<3>(src.Col(3));
+
+	Mat<4, 4, T> ret = Mat<4, 4, T>::Identity();
+	for (size_t i = 3; i--; )
+	{
+		for (size_t j = 3; j--; ret[i][j] = inv[i][j]);
+		ret[i][3] = -t[i];
+	}
+	return ret;
+}
+
+#ifdef NANOGL_SSE
+// Each result row is a sum of the rows of rhs scaled by the elements of the matching lhs row
+inline Mat<4, 4, float> operator*(const Mat<4, 4, float>& lhs, const Mat<4, 4, float>& rhs)
+{
+	__m128 r[4];
+	for (int k = 0; k < 4; k++) r[k] = _mm_loadu_ps(&rhs[k][0]);
+
+	Mat<4, 4, float> result;
+	for (int i = 0; i < 4; i++)
+	{
+		const Vec<4, float>& l = lhs[i];
+		__m128 row = _mm_mul_ps(_mm_set1_ps(l[0]), r[0]);
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(l[1]), r[1]));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(l[2]), r[2]));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(l[3]), r[3]));
+		_mm_storeu_ps(&result[i][0], row);
+	}
+	return result;
+}
+
+#define NANOGL_SHUFFLE(a, b, x, y, z, w) _mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x))
+#define NANOGL_SWIZZLE(v, x, y, z, w) _mm_castsi128_ps(_mm_shuffle_epi32(_mm_castps_si128(v), _MM_SHUFFLE(w, z, y, x)))
+
+// Block inverse on the four 2x2 sub-matrices, each one held in a single register as (m00, m01, m10, m11)
+template<>
+struct MI<4, float>
+{
+	static __m128 Mat2Mul(__m128 a, __m128 b)
+	{
+		return _mm_add_ps(_mm_mul_ps(a, NANOGL_SWIZZLE(b, 0, 3, 0, 3)), _mm_mul_ps(NANOGL_SWIZZLE(a, 1, 0, 3, 2), NANOGL_SWIZZLE(b, 2, 1, 2, 1)));
+	}
+
+	// adj(a) * b
+	static __m128 Mat2AdjMul(__m128 a, __m128 b)
+	{
+		return _mm_sub_ps(_mm_mul_ps(NANOGL_SWIZZLE(a, 3, 3, 0, 0), b), _mm_mul_ps(NANOGL_SWIZZLE(a, 1, 1, 2, 2), NANOGL_SWIZZLE(b, 2, 3, 0, 1)));
+	}
+
+	// a * adj(b)
+	static __m128 Mat2MulAdj(__m128 a, __m128 b)
+	{
+		return _mm_sub_ps(_mm_mul_ps(a, NANOGL_SWIZZLE(b, 3, 0, 3, 0)), _mm_mul_ps(NANOGL_SWIZZLE(a, 1, 0, 3, 2), NANOGL_SWIZZLE(b, 2, 1, 2, 1)));
+	}
+
+	static Mat<4, 4, float> Invert(const Mat<4, 4, float>& src)
+	{
+		__m128 r0 = _mm_loadu_ps(&src[0][0]);
+		__m128 r1 = _mm_loadu_ps(&src[1][0]);
+		__m128 r2 = _mm_loadu_ps(&src[2][0]);
+		__m128 r3 = _mm_loadu_ps(&src[3][0]);
+
+		__m128 A = _mm_movelh_ps(r0, r1);
+		__m128 B = _mm_movehl_ps(r1, r0);
+		__m128 C = _mm_movelh_ps(r2, r3);
+		__m128 D = _mm_movehl_ps(r3, r2);
+
+		// (|A|, |B|, |C|, |D|)
+		__m128 detSub = _mm_sub_ps(
+			_mm_mul_ps(NANOGL_SHUFFLE(r0, r2, 0, 2, 0, 2), NANOGL_SHUFFLE(r1, r3, 1, 3, 1, 3)),
+			_mm_mul_ps(NANOGL_SHUFFLE(r0, r2, 1, 3, 1, 3), NANOGL_SHUFFLE(r1, r3, 0, 2, 0, 2)));
+		__m128 detA = NANOGL_SWIZZLE(detSub, 0, 0, 0, 0);
+		__m128 detB = NANOGL_SWIZZLE(detSub, 1, 1, 1, 1);
+		__m128 detC = NANOGL_SWIZZLE(detSub, 2, 2, 2, 2);
+		__m128 detD = NANOGL_SWIZZLE(detSub, 3, 3, 3, 3);
+
+		__m128 D_C = Mat2AdjMul(D, C);
+		__m128 A_B = Mat2AdjMul(A, B);
+		__m128 X = _mm_sub_ps(_mm_mul_ps(detD, A), Mat2Mul(B, D_C));
+		__m128 W = _mm_sub_ps(_mm_mul_ps(detA, D), Mat2Mul(C, A_B));
+		__m128 Y = _mm_sub_ps(_mm_mul_ps(detB, C), Mat2MulAdj(D, A_B));
+		__m128 Z = _mm_sub_ps(_mm_mul_ps(detC, B), Mat2MulAdj(A, D_C));
+
+		// |M| = |A||D| + |B||C| - tr((A#B)(D#C))
+		__m128 tr = _mm_mul_ps(A_B, NANOGL_SWIZZLE(D_C, 0, 2, 1, 3));
+		tr = _mm_add_ps(tr, NANOGL_SWIZZLE(tr, 2, 3, 0, 1));
+		tr = _mm_add_ps(tr, NANOGL_SWIZZLE(tr, 1, 0, 3, 2));
+		__m128 detM = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC)), tr);
+
+		__m128 rDetM = _mm_div_ps(_mm_setr_ps(1.f, -1.f, -1.f, 1.f), detM);
+		X = _mm_mul_ps(X, rDetM);
+		Y = _mm_mul_ps(Y, rDetM);
+		Z = _mm_mul_ps(Z, rDetM);
+		W = _mm_mul_ps(W, rDetM);
+
+		Mat<4, 4, float> ret;
+		_mm_storeu_ps(&ret[0][0], NANOGL_SHUFFLE(X, Y, 3, 1, 3, 1));
+		_mm_storeu_ps(&ret[1][0], NANOGL_SHUFFLE(X, Y, 2, 0, 2, 0));
+		_mm_storeu_ps(&ret[2][0], NANOGL_SHUFFLE(Z, W, 3, 1, 3, 1));
+		_mm_storeu_ps(&ret[3][0], NANOGL_SHUFFLE(Z, W, 2, 0, 2, 0));
+		return ret;
+	}
+
+	static Mat<4, 4, float> InvertTranspose(const Mat<4, 4, float>& src)
+	{
+		return Invert(src).Transpose();
+	}
+};
+
+#undef NANOGL_SHUFFLE
+#undef NANOGL_SWIZZLE
+#endif
+
 template <size_t DimRows, size_t DimCols, class T>
 std::ostream& operator<<(std::ostream& out, Mat<DimRows, DimCols, T>& m) 
 {
@@ -1,14 +1,19 @@
+#include <future>
 #include <iostream>
+#include <memory>
 #include <vector>
-#include <limits>
 
 #include "tgaimage.h"
+#include "tgawriter.h"
 #include "geometry.h"
 #include "nanogl.h"
 #include "ModelRenderer.h"
+#include "profiler.h"
+#include "rendertargets.h"
 
 constexpr int width = 800;
 constexpr int height = 800;
+constexpr int samples = 4;	// MSAA sample count: 1, 2, 4 or 8
 
 const Vec3f lightDir(1, 1, 2);
 const Vec3f eye(1, 1, 4);
@@ -23,42 +28,40 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
-	float* zbuffer = new float[width * height];
-	float* shadowbuffer = new float[width * height];
-	for (int i = width * height; i--; zbuffer[i] = shadowbuffer[i] = -std::numeric_limits<float>::max());
-
-	TGAImage* AOImage = new TGAImage(width, height, 3);
-	TGAImage* depthImage = new TGAImage(width, height, 3);
-	TGAImage frame(width, height, 3);
+	RenderTargetPool targets;
+	// Shared by all models so they occlude each other
+	float* zbuffer = targets.AcquireDepth(width, height).GetData();
+	float* shadowbuffer = targets.AcquireDepth(width, height).GetData();
+	TGAImage& AOImage = targets.AcquireImage(width, height, 3);
+	TGAImage& depthImage = targets.AcquireImage(width, height, 3);
+	NANOGL_PROFILE_BEGIN_FRAME();
+	MultisampleImage multisampleFrame(width, height, samples);
 	
 	// Set BG
-	for (int x = 0; x < width; x++)
-	{
-		for (int y = 0; y < height; y++)
-		{
-			frame.SetPixel(x, y, TGAColor(20, 20, 20));
-		}
-	}
+	multisampleFrame.Clear(TGAColor(20, 20, 20));
 	
+	// The next model loads while the current one renders
+	std::future<std::unique_ptr<Model>> nextModel = Model::LoadAsync(argv[1]);
 	for (int i = 0; i < argc - 1; i++)
 	{
-		ModelRenderer modelRenderer(argv[i+1], AOImage, depthImage, zbuffer, shadowbuffer);
-		modelRenderer.Render(frame, eye, center, up, lightDir);
+		std::unique_ptr<Model> model = nextModel.get();
+		if (i + 2 < argc)
+			nextModel = Model::LoadAsync(argv[i + 2]);
+		ModelRenderer modelRenderer(*model, &AOImage, &depthImage, zbuffer, shadowbuffer);
+		modelRenderer.Render(multisampleFrame, eye, center, up, lightDir);
 	}
 
-	AOImage->FlipVertical();
-	AOImage->WriteTGAImage("ao.tga");
-	
-	depthImage->FlipVertical();
-	depthImage->WriteTGAImage("depth.tga");
-
-	frame.FlipVertical();
-	frame.WriteTGAImage("framebuffer.tga");
+	TGAImage& frame = targets.AcquireImage(width, height, 3);
+	multisampleFrame.Resolve(frame);
 
-	delete AOImage;
-	delete depthImage;
-	delete[] zbuffer;
-	delete[] shadowbuffer;
+	// Rows are kept bottom to top and written with a bottom left origin, no flip needed.
+	// The writer gets views of the pooled memory, which stays alive until the flush.
+	TGAWriter writer;
+	writer.Enqueue(TGAImage(AOImage.GetBuffer(), width, height, 3), "ao.tga");
+	writer.Enqueue(TGAImage(depthImage.GetBuffer(), width, height, 3), "depth.tga");
+	writer.Enqueue(TGAImage(frame.GetBuffer(), width, height, 3), "framebuffer.tga");
+	writer.Flush();
+	NANOGL_PROFILE_END_FRAME("profile.json");
 	
 	return 0;
 }
\ No newline at end of file
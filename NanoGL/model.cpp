@@ -1,11 +1,14 @@
 #include "model.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <future>
+#include <limits>
 #include <sstream>
 #include <string>
 
-Model::Model(const char* filename, const char* diffuseMapFile, const char* normalMapFile, const char* specularMapFile)
+Model::Model(const char* filename, const char* diffuseMapFile, const char* normalMapFile, const char* specularMapFile, bool compressTextures)
 {
 	std::ifstream in;
 	in.open(filename, std::ifstream::in);
@@ -16,6 +19,34 @@ Model::Model(const char* filename, const char* diffuseMapFile, const char* norma
 		return;
 	}
 
+	// Textures only depend on the file names, they are read and decoded on other threads while the OBJ is parsed
+	TextureFormat colorFormat = compressTextures ? TextureFormat::BC1 : TextureFormat::BGRA8;
+	TextureFormat normalFormat = compressTextures ? TextureFormat::BC5 : TextureFormat::BGRA8;
+	std::vector<std::future<void>> textureLoads;
+	auto loadTexture = [&](std::string file, std::shared_ptr<const Texture>& tex, const char* suffix, TextureFormat format)
+	{
+		textureLoads.push_back(std::async(std::launch::async, [this, file, &tex, suffix, format] { LoadTexture(file, tex, suffix, format); }));
+	};
+
+	if (diffuseMapFile)
+		loadTexture(diffuseMapFile, m_DiffuseMap, nullptr, colorFormat);
+	else
+		loadTexture(filename, m_DiffuseMap, "_diffuse.tga", colorFormat);
+
+	if (normalMapFile)
+		loadTexture(normalMapFile, m_NormalMap, nullptr, normalFormat);
+	else
+		loadTexture(filename, m_NormalMap, "_nm_tangent.tga", normalFormat);
+
+	// SampleSpecularMap() reads the normal map, encoding this one would cost time and gain nothing
+	if (diffuseMapFile)
+		loadTexture(diffuseMapFile, m_SpecularMap, nullptr, TextureFormat::BGRA8);
+	else
+		loadTexture(filename, m_SpecularMap, "_spec.tga", TextureFormat::BGRA8);
+
+	// The shader scales glow 30 times, it stays uncompressed so the block error isn't scaled with it
+	loadTexture(filename, m_GlowMap, "_glow.tga", TextureFormat::BGRA8);
+
 	std::string line;
 	while (std::getline(in, line))
 	{
@@ -63,25 +94,11 @@ Model::Model(const char* filename, const char* diffuseMapFile, const char* norma
 	}
 
 	in.close();
-	std::clog << "#" << filename << " v#" << m_Verts.size() << " f# " << m_Faces.size() << " vt#" << m_UVs.size() << " vn#" << m_Norms.size() << std::endl;
-
-	// Load textures
-	if (diffuseMapFile)
-		LoadTexture(diffuseMapFile, m_DiffuseMap);
-	else
-		LoadTexture(filename, m_DiffuseMap, "_diffuse.tga");
-
-	if (normalMapFile)
-		LoadTexture(normalMapFile, m_NormalMap);
-	else
-		LoadTexture(filename, m_NormalMap, "_nm_tangent.tga");
-
-	if (diffuseMapFile)
-		LoadTexture(diffuseMapFile, m_SpecularMap);
-	else
-		LoadTexture(filename, m_SpecularMap, "_spec.tga");
+	std::clog << "#" + std::string(filename) + " v#" + std::to_string(m_Verts.size()) + " f# " + std::to_string(m_Faces.size()) + " vt#" + std::to_string(m_UVs.size()) + " vn#" + std::to_string(m_Norms.size()) + "\n" << std::flush;
+	BuildBVH();
 
-	LoadTexture(filename, m_GlowMap, "_glow.tga");
+	for (std::future<void>& load : textureLoads)
+		load.get();
 	
 }
 
@@ -89,6 +106,14 @@ Model::~Model()
 {
 }
 
+std::future<std::unique_ptr<Model>> Model::LoadAsync(std::string filename, std::string diffuseMapFile, std::string normalMapFile, std::string specularMapFile, bool compressTextures)
+{
+	return std::async(std::launch::async, [=] {
+		auto name = [](const std::string& file) { return file.empty() ? nullptr : file.c_str(); };
+		return std::unique_ptr<Model>(new Model(filename.c_str(), name(diffuseMapFile), name(normalMapFile), name(specularMapFile), compressTextures));
+	});
+}
+
 int Model::nVerts() const
 {
 	return (int)m_Verts.size();
@@ -147,14 +172,12 @@ Vec3f Model::GetNormal(int iFace, int nthVertex, bool normalize) const
 
 TGAColor Model::SampleDiffuseMap(Vec2f uvf) const
 {
-	Vec2i uv(uvf[0] * m_DiffuseMap.GetWidth(), uvf[1] * m_DiffuseMap.GetHeight());
-	return m_DiffuseMap.GetPixel(uv[0], uv[1]);
+	return m_DiffuseMap->Sample(uvf[0], uvf[1]);
 }
 
 Vec3f Model::SampleNormalMap(Vec2f uvf) const
 {
-	Vec2i uv(uvf[0] * m_NormalMap.GetWidth(), uvf[1] * m_NormalMap.GetHeight());
-	TGAColor c = m_NormalMap.GetPixel(uv[0], uv[1]);
+	TGAColor c = m_NormalMap->Sample(uvf[0], uvf[1]);
 	Vec3f res;
 	for (int i = 0; i < 3; i++)
 		res[2 - i] = (float)c.Raw[i] / 255.0f * 2.0f - 1.0f;
@@ -163,22 +186,146 @@ Vec3f Model::SampleNormalMap(Vec2f uvf) const
 
 float Model::SampleSpecularMap(Vec2f uvf) const
 {
-	Vec2i uv(uvf[0] * m_NormalMap.GetWidth(), uvf[1] * m_NormalMap.GetHeight());
-	return (float)m_NormalMap.GetPixel(uv[0], uv[1]).Raw[0];
+	return (float)m_NormalMap->Sample(uvf[0], uvf[1]).Raw[0];
 }
 
 TGAColor Model::SampleGlowMap(Vec2f uvf) const
 {
-	Vec2i uv(uvf[0] * m_GlowMap.GetWidth(), uvf[1] * m_GlowMap.GetHeight());
-	return m_GlowMap.GetPixel(uv[0], uv[1]);
+	return m_GlowMap->Sample(uvf[0], uvf[1]);
 }
 
-void Model::LoadTexture(std::string filename, TGAImage& img, const char* suffix)
+void Model::BuildBVH()
 {
+	m_BVH.clear();
+	m_Meshlets.clear();
+	m_BVHHeight = 0;
+	if (m_Faces.empty())
+		return;
+
+	std::vector<int> order(m_Faces.size());
+	std::vector<Vec3f> centroids(m_Faces.size());
+	for (int i = 0; i < nFaces(); i++)
+	{
+		order[i] = i;
+		centroids[i] = (GetVert(i, 0) + GetVert(i, 1) + GetVert(i, 2)) / 3.0f;
+	}
+
+	m_BVH.reserve(2 * m_Faces.size() / MaxFacesPerLeaf + 1);
+	BuildBVHNode(order, centroids, 0, nFaces(), 0);
+
+	std::vector<std::vector<Vec3i>> faces(m_Faces.size());
+	for (size_t i = 0; i < order.size(); i++)
+		faces[i].swap(m_Faces[order[i]]);
+	m_Faces.swap(faces);
+
+	// Meshlet bounds need the faces in their final order
+	for (BVHNode& node : m_BVH)
+	{
+		if (node.RightChild >= 0)
+			continue;
+		node.Meshlet = (int)m_Meshlets.size();
+		m_Meshlets.push_back(BuildMeshlet(node));
+	}
+}
+
+Meshlet Model::BuildMeshlet(const BVHNode& leaf) const
+{
+	Meshlet meshlet;
+	meshlet.FirstFace = leaf.FirstFace;
+	meshlet.FaceCount = leaf.FaceCount;
+
+	int first = leaf.FirstFace, count = leaf.FaceCount;
+	Vec3f center = (leaf.BoundsMin + leaf.BoundsMax) * 0.5f;
+
+	// Geometric normals, these decide the winding the rasterizer sees
+	std::vector<Vec3f> normals;
+	normals.reserve(count);
+	Vec3f axis(0, 0, 0);
+	float radius = 0;
+	for (int i = first; i < first + count; i++)
+	{
+		Vec3f v0 = GetVert(i, 0), v1 = GetVert(i, 1), v2 = GetVert(i, 2);
+		radius = std::max(radius, std::max((v0 - center).Magnitude(), std::max((v1 - center).Magnitude(), (v2 - center).Magnitude())));
+
+		Vec3f n = Cross(v1 - v0, v2 - v0);
+		float length = n.Magnitude();
+		if (length <= 0)
+			continue;	// degenerate faces never produce fragments
+		normals.push_back(n / length);
+		axis = axis + normals.back();
+	}
+	meshlet.Center = center;
+	meshlet.Radius = radius;
+
+	float axisLength = axis.Magnitude();
+	if (normals.empty() || axisLength <= 0)
+		return meshlet;
+	axis = axis / axisLength;
+
+	float minDot = 1.0f;
+	for (const Vec3f& n : normals)
+		minDot = std::min(minDot, n * axis);
+
+	// Cones wider than a hemisphere can not be rejected from any viewpoint
+	meshlet.ConeAxis = axis;
+	meshlet.ConeCutoff = minDot <= 0.1f ? 1.0f : std::sqrt(1.0f - minDot * minDot);
+	return meshlet;
+}
+
+// Median split along the longest axis of the face centroids
+int Model::BuildBVHNode(std::vector<int>& order, const std::vector<Vec3f>& centroids, int first, int count, int level)
+{
+	int index = (int)m_BVH.size();
+	m_BVH.push_back(BVHNode());
+	m_BVHHeight = std::max(m_BVHHeight, level + 1);
+
+	Vec3f bmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	Vec3f bmax = bmin * -1.0f;
+	Vec3f cmin = bmin, cmax = bmax;
+	for (int i = first; i < first + count; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			Vec3f v = GetVert(order[i], j);
+			for (int k = 0; k < 3; k++)
+			{
+				bmin[k] = std::min(bmin[k], v[k]);
+				bmax[k] = std::max(bmax[k], v[k]);
+			}
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			cmin[k] = std::min(cmin[k], centroids[order[i]][k]);
+			cmax[k] = std::max(cmax[k], centroids[order[i]][k]);
+		}
+	}
+	m_BVH[index].BoundsMin = bmin;
+	m_BVH[index].BoundsMax = bmax;
+	m_BVH[index].FirstFace = first;
+	m_BVH[index].FaceCount = count;
+	if (count <= MaxFacesPerLeaf)
+		return index;
+
+	Vec3f extent = cmax - cmin;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	int half = count / 2;
+	std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+		[&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+	BuildBVHNode(order, centroids, first, half, level + 1);
+	int right = BuildBVHNode(order, centroids, first + half, count - half, level + 1);
+	m_BVH[index].RightChild = right;
+	return index;
+}
+
+// Runs on a loading thread of the constructor, lines are logged with a single write so they don't interleave
+void Model::LoadTexture(std::string filename, std::shared_ptr<const Texture>& tex, const char* suffix, TextureFormat format)
+{
+	// Explicitly named maps are flipped, the ones found next to the model aren't
 	if (!suffix)
 	{
-		std::clog << "Texture file " << filename << " loading " << (img.ReadTGAImage(filename.c_str()) ? "OK" : "FAILED") << std::endl;
-		img.FlipVertical();
+		tex = TextureCache::Get().Load(filename, true, format);
+		std::clog << "Texture file " + filename + " loading " + (tex->IsEmpty() ? "FAILED" : "OK") + "\n" << std::flush;
 		return;
 	}
 
@@ -187,11 +334,11 @@ void Model::LoadTexture(std::string filename, TGAImage& img, const char* suffix)
 	if (dot != std::string::npos)
 	{
 		texfile = texfile.substr(0, dot) + std::string(suffix);
-		std::clog << "Texture file " << texfile << " loading " << (img.ReadTGAImage(texfile.c_str()) ? "OK" : "FAILED") << std::endl;
+		tex = TextureCache::Get().Load(texfile, false, format);
+		std::clog << "Texture file " + texfile + " loading " + (tex->IsEmpty() ? "FAILED" : "OK") + "\n" << std::flush;
 	}
 	else
 	{
-		std::cerr << "Invalid suffix/filename name " << texfile << std::endl;
+		std::cerr << "Invalid suffix/filename name " + texfile + "\n" << std::flush;
 	}
-}
-
+}
\ No newline at end of file
@@ -1,15 +1,49 @@
 #pragma once
 
+#include <future>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "geometry.h"
 #include "tgaimage.h"
+#include "texture.h"
+#include "texturecache.h"
+
+// Node of the bounding volume hierarchy built over the faces at load time.
+// Faces are reordered so that every node covers a contiguous range of them.
+struct BVHNode
+{
+	Vec3f BoundsMin, BoundsMax;
+	int FirstFace = 0, FaceCount = 0;
+	int RightChild = -1;	// The left child directly follows its parent, -1 for leaves
+	int Meshlet = -1;		// Index into GetMeshlets() for leaves
+};
+
+// Leaf cluster of the BVH with the bounds used to reject it as a whole.
+// All face normals lie within ConeCutoff (the sine of the cone half angle) of ConeAxis,
+// a cutoff of 1 marks a cone too wide to ever be rejected.
+struct Meshlet
+{
+	Vec3f Center;
+	float Radius = 0.0f;
+	Vec3f ConeAxis;
+	float ConeCutoff = 1.0f;
+	int FirstFace = 0, FaceCount = 0;
+};
 
 class Model
 {
 public:
-	Model(const char* filename, const char* diffuseMapFile = nullptr, const char* normalMapFile = nullptr, const char* specularMapFile = nullptr);
+	// compressTextures keeps the diffuse map as BC1 and the normal map as BC5. The specular exponent is read from the
+	// normal map's blue channel, which BC5 rebuilds from unit length, so it changes with compression as well.
+	// The textures are loaded concurrently with each other and with the OBJ parse, the model is complete on return.
+	Model(const char* filename, const char* diffuseMapFile = nullptr, const char* normalMapFile = nullptr, const char* specularMapFile = nullptr, bool compressTextures = false);
 	~Model();
+
+	// Loads a model on another thread, so a batch driver can render one model while the next one loads.
+	// Empty map file names stand for the maps found next to the model.
+	static std::future<std::unique_ptr<Model>> LoadAsync(std::string filename, std::string diffuseMapFile = "", std::string normalMapFile = "", std::string specularMapFile = "", bool compressTextures = false);
 	
 	int nVerts() const;
 	int nFaces() const;
@@ -28,19 +62,33 @@ public:
 	float SampleSpecularMap(Vec2f uvf) const;
 	TGAColor SampleGlowMap(Vec2f uvf) const;
 
-	const TGAImage& GetDiffuseMap() const { return m_DiffuseMap; }
-	const TGAImage& GetNormalMap() const { return m_NormalMap; }
-	const TGAImage& GetSpecularMap() const { return m_SpecularMap; }
+	const Texture& GetDiffuseMap() const { return *m_DiffuseMap; }
+	const Texture& GetNormalMap() const { return *m_NormalMap; }
+	const Texture& GetSpecularMap() const { return *m_SpecularMap; }
+
+	const std::vector<BVHNode>& GetBVH() const { return m_BVH; }
+	const std::vector<Meshlet>& GetMeshlets() const { return m_Meshlets; }
+	// Levels of the BVH, a depth first walk never holds more than this many pending nodes
+	int GetBVHHeight() const { return m_BVHHeight; }
+
+	// Leaves are split until they hold at most this many faces, so meshlets have 64 to 128 faces
+	static const int MaxFacesPerLeaf = 128;
 private:
-	void LoadTexture(std::string filename, TGAImage& img, const char* suffix = nullptr);
+	void LoadTexture(std::string filename, std::shared_ptr<const Texture>& tex, const char* suffix, TextureFormat format);
+	void BuildBVH();
+	int BuildBVHNode(std::vector<int>& order, const std::vector<Vec3f>& centroids, int first, int count, int level);
+	Meshlet BuildMeshlet(const BVHNode& leaf) const;
 private:
-	TGAImage m_DiffuseMap;
-	TGAImage m_NormalMap;
-	TGAImage m_SpecularMap;
-	TGAImage m_GlowMap;
+	std::shared_ptr<const Texture> m_DiffuseMap = TextureCache::GetEmptyTexture();
+	std::shared_ptr<const Texture> m_NormalMap = TextureCache::GetEmptyTexture();
+	std::shared_ptr<const Texture> m_SpecularMap = TextureCache::GetEmptyTexture();
+	std::shared_ptr<const Texture> m_GlowMap = TextureCache::GetEmptyTexture();
 
 	std::vector<std::vector<Vec3i>> m_Faces; // Vec3i --> vertex/uv/normal
 	std::vector<Vec3f> m_Verts;
 	std::vector<Vec2f> m_UVs;
 	std::vector<Vec3f> m_Norms;
+	std::vector<BVHNode> m_BVH;
+	int m_BVHHeight = 0;
+	std::vector<Meshlet> m_Meshlets;
 };
\ No newline at end of file
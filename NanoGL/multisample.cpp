@@ -0,0 +1,79 @@
+#include "multisample.h"
+
+#include <algorithm>
+#include <iostream>
+
+// Standard Direct3D sample patterns, in 1/16 pixel
+static const Vec2f samples1[] = { Vec2f(0, 0) };
+static const Vec2f samples2[] = { Vec2f(4, 4) / 16.0f, Vec2f(-4, -4) / 16.0f };
+static const Vec2f samples4[] = { Vec2f(-2, -6) / 16.0f, Vec2f(6, -2) / 16.0f, Vec2f(-6, 2) / 16.0f, Vec2f(2, 6) / 16.0f };
+static const Vec2f samples8[] = {
+	Vec2f(1, -3) / 16.0f, Vec2f(-1, 3) / 16.0f, Vec2f(5, 1) / 16.0f, Vec2f(-3, -5) / 16.0f,
+	Vec2f(-5, 5) / 16.0f, Vec2f(-7, -1) / 16.0f, Vec2f(3, 7) / 16.0f, Vec2f(7, -7) / 16.0f
+};
+
+MultisampleImage::MultisampleImage(int width, int height, int samples)
+	: m_Width(width), m_Height(height), m_Samples(samples)
+{
+	switch (samples)
+	{
+	case 1: m_Offsets = samples1; break;
+	case 2: m_Offsets = samples2; break;
+	case 4: m_Offsets = samples4; break;
+	case 8: m_Offsets = samples8; break;
+	default:
+		std::cerr << "Unsupported sample count " << samples << ", using 4 samples" << std::endl;
+		m_Samples = 4;
+		m_Offsets = samples4;
+		break;
+	}
+
+	m_Depth.resize((size_t)m_Width * m_Height * m_Samples);
+	m_Colors.resize(m_Depth.size());
+	Clear(TGAColor());
+}
+
+void MultisampleImage::Clear(const TGAColor& color, float depth)
+{
+	FillDepth(m_Depth.data(), m_Depth.size(), depth);
+	std::fill(m_Colors.begin(), m_Colors.end(), color.Val);
+}
+
+bool MultisampleImage::Resolve(TGAImage& image) const
+{
+	if (image.GetWidth() != m_Width || image.GetHeight() != m_Height)
+	{
+		std::cerr << "Can't resolve a " << m_Width << "x" << m_Height << " multisample image into a " << image.GetWidth() << "x" << image.GetHeight() << " image" << std::endl;
+		return false;
+	}
+
+	switch (image.GetBytesPerPixel())
+	{
+	case 1: ResolveTo(TGAViewR8(image)); return true;
+	case 3: ResolveTo(TGAViewRGB8(image)); return true;
+	case 4: ResolveTo(TGAViewRGBA8(image)); return true;
+	}
+	return false;
+}
+
+template<uint8_t BPP>
+void MultisampleImage::ResolveTo(const TGAImageView<BPP>& view) const
+{
+	const uint32_t* src = m_Colors.data();
+	for (int y = 0; y < m_Height; y++)
+	{
+		for (int x = 0; x < m_Width; x++, src += m_Samples)
+		{
+			unsigned sum[4] = { 0, 0, 0, 0 };
+			for (int s = 0; s < m_Samples; s++)
+			{
+				TGAColor c(src[s]);
+				for (int i = 0; i < 4; i++) sum[i] += c.Raw[i];
+			}
+
+			TGAColor resolved;
+			for (int i = 0; i < 4; i++) resolved.Raw[i] = (sum[i] + m_Samples / 2) / m_Samples;
+			view.Set(x, y, resolved);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "geometry.h"
+#include "tgaimage.h"
+#include "depthbuffer.h"
+
+// Color and depth render target with several coverage samples per pixel.
+// Triangles are shaded once per pixel and the color is stored in every covered sample,
+// Resolve() averages the samples into a regular image.
+class MultisampleImage
+{
+public:
+	// Supported sample counts are 1, 2, 4 and 8
+	MultisampleImage(int width, int height, int samples);
+
+	void Clear(const TGAColor& color, float depth = -std::numeric_limits<float>::max());
+	bool Resolve(TGAImage& image) const;
+
+	int GetWidth() const { return m_Width; }
+	int GetHeight() const { return m_Height; }
+	int GetSamples() const { return m_Samples; }
+
+	// Sample position relative to the pixel's integer coordinates, which is where single sampled rendering samples
+	const Vec2f& GetSampleOffset(int sample) const { return m_Offsets[sample]; }
+
+	// The samples of one pixel are stored next to each other
+	float* GetDepth(int x, int y) { return &m_Depth[((size_t)y * m_Width + x) * m_Samples]; }
+	uint32_t* GetColor(int x, int y) { return &m_Colors[((size_t)y * m_Width + x) * m_Samples]; }
+private:
+	template<uint8_t BPP> void ResolveTo(const TGAImageView<BPP>& view) const;
+private:
+	int m_Width, m_Height, m_Samples;
+	const Vec2f* m_Offsets;
+	std::vector<float> m_Depth;
+	std::vector<uint32_t> m_Colors;
+};
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "nanogl.h"
+#include "profiler.h"
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 
@@ -7,6 +9,10 @@ Mat4x4 ModelView;
 Mat4x4 Viewport;
 Mat4x4 Projection;
 
+static CullMode FaceCulling = CullMode::None;
+static Winding FrontFace = Winding::CounterClockwise;
+static RasterStats Stats;
+
 IShader::~IShader() {}
 
 void CreateViewportMatrix(int x, int y, int w, int h)
@@ -41,6 +47,22 @@ void LookAt(Vec3f eye, Vec3f center, Vec3f up)
 	}
 }
 
+void SetCullMode(CullMode mode, Winding frontFace)
+{
+	FaceCulling = mode;
+	FrontFace = frontFace;
+}
+
+RasterStats& GetRasterStats()
+{
+	return Stats;
+}
+
+void ResetRasterStats()
+{
+	Stats = RasterStats();
+}
+
 Vec3f Barycentric(const Vec2f& A, const Vec2f& B, const Vec2f& C, const Vec2f& P)
 {
 	Vec3f s[2];
@@ -55,16 +77,149 @@ Vec3f Barycentric(const Vec2f& A, const Vec2f& B, const Vec2f& C, const Vec2f& P
 		return Vec3f(1.0f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
 	return Vec3f(-1, 1, 1); // in this case generate negative coordinates, it will be thrown away by the rasterizator
 }
-void Triangle(Vec4f* pts, IShader& shader, TGAImage& image, float* zbuffer)
+
+// Vertices closer than this in w are clipped away, this also removes everything behind the camera
+const float nearPlaneW = 1e-2f;
+// Triangles reaching further than this outside the image are clipped to keep screen coordinates well conditioned
+const float guardBandPixels = 4096.0f;
+
+enum ClipPlane
+{
+	ClipNear = 0, ClipLeft, ClipRight, ClipBottom, ClipTop,
+	GuardLeft, GuardRight, GuardBottom, GuardTop,
+	ClipPlaneCount
+};
+
+struct ClipVertex
+{
+	Vec4f Pos;	// Viewport * clip coordinates
+	Vec3f Bar;	// Barycentric weights in the submitted triangle
+};
+
+// Signed distance to a clip plane in homogeneous screen space, negative means outside
+static float PlaneDistance(const Vec4f& v, int plane, float width, float height)
+{
+	switch (plane)
+	{
+	case ClipNear: return v[3] - nearPlaneW;
+	case ClipLeft: return v[0];
+	case ClipRight: return width * v[3] - v[0];
+	case ClipBottom: return v[1];
+	case ClipTop: return height * v[3] - v[1];
+	case GuardLeft: return v[0] + guardBandPixels * v[3];
+	case GuardRight: return (width + guardBandPixels) * v[3] - v[0];
+	case GuardBottom: return v[1] + guardBandPixels * v[3];
+	default: return (height + guardBandPixels) * v[3] - v[1];
+	}
+}
+
+static unsigned Outcode(const Vec4f& v, float width, float height)
+{
+	unsigned code = 0;
+	for (int plane = 0; plane < ClipPlaneCount; plane++)
+	{
+		if (PlaneDistance(v, plane, width, height) < 0)
+			code |= 1u << plane;
+	}
+	return code;
+}
+
+Visibility TestBox(const Vec3f& boundsMin, const Vec3f& boundsMax, int width, int height)
+{
+	Mat4x4 m = Viewport * Projection * ModelView;
+	const unsigned viewPlanes = (1u << GuardLeft) - 1;
+	unsigned outsideAll = viewPlanes, outsideAny = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		Vec3f corner((i & 1) ? boundsMax.x : boundsMin.x, (i & 2) ? boundsMax.y : boundsMin.y, (i & 4) ? boundsMax.z : boundsMin.z);
+		unsigned code = Outcode(m * Embed<4>(corner), width, height) & viewPlanes;
+		outsideAll &= code;
+		outsideAny |= code;
+	}
+	Stats.ClustersTested++;
+	if (outsideAll)
+	{
+		Stats.ClustersOutside++;
+		return Visibility::Outside;
+	}
+	return outsideAny ? Visibility::Intersecting : Visibility::Inside;
+}
+
+Vec4f GetViewer()
+{
+	// The viewer is the point (or direction) that projects to w = 0 in the middle of the view
+	Vec4f viewer = (Viewport * Projection * ModelView).Invert() * Embed<4>(Vec3f(0, 0, 1), 0.0f);
+	Vec3f position = Proj<3>(viewer);
+	if (std::abs(viewer[3]) > 1e-6f * position.Magnitude())
+		return viewer / viewer[3];
+	return Embed<4>(position.Normalize(), 0.0f);
+}
+
+bool TestCone(const Vec4f& viewer, const Vec3f& center, float radius, const Vec3f& axis, float cutoff)
+{
+	if (FaceCulling == CullMode::None || cutoff >= 1.0f)
+		return false;
+
+	// Counter clockwise faces have their geometric normal pointing at the viewer when they are front facing
+	bool facingViewer = (FaceCulling == CullMode::Front) != (FrontFace == Winding::Clockwise);
+	Vec3f a = facingViewer ? axis * -1.0f : axis;
+	Vec3f view = center * viewer[3] - Proj<3>(viewer);
+	if (view * a >= cutoff * view.Magnitude() + radius * std::abs(viewer[3]))
+	{
+		Stats.ClustersBackFacing++;
+		return true;
+	}
+	return false;
+}
+
+// Sutherland-Hodgman against one plane, returns the new vertex count
+static int ClipPolygon(const ClipVertex* in, int count, ClipVertex* out, int plane, float width, float height)
+{
+	int n = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const ClipVertex& a = in[i];
+		const ClipVertex& b = in[(i + 1) % count];
+		float da = PlaneDistance(a.Pos, plane, width, height);
+		float db = PlaneDistance(b.Pos, plane, width, height);
+		if (da >= 0)
+			out[n++] = a;
+		if ((da >= 0) != (db >= 0))
+		{
+			float t = da / (da - db);
+			out[n].Pos = a.Pos + (b.Pos - a.Pos) * t;
+			out[n].Bar = a.Bar + (b.Bar - a.Bar) * t;
+			n++;
+		}
+	}
+	return n;
+}
+
+// Recorders of the fragments that get written
+struct NoVisibility
+{
+	void Record(size_t, const Vec3f&) const {}
+};
+
+struct VisibilityRecorder
+{
+	VisibilitySample* Data;
+	int Face, Instance;
+
+	void Record(size_t i, const Vec3f& bar) const { Data[i] = VisibilitySample{ Face, Instance, bar }; }
+};
+
+// Depth is one of the depth views, fragment depths are encoded once and compared in the stored format
+template<uint8_t BPP, typename Depth, typename Recorder>
+static void RasterizeTriangle(const ClipVertex* verts, const Mat<4, 3, float>& clipc, bool clipped, IShader& shader, const TGAImageView<BPP>& image, const Depth& depth, const Recorder& recorder)
 {
-	Mat<4, 3, float> clipc;
 	Mat<3, 2, float> pts2;
+	Mat<3, 3, float> bars; // maps barycentrics of this triangle to the submitted one
 	for (int i = 0; i < 3; i++)
 	{
-		clipc.SetCol(i, pts[i]);
-		pts2[i] = Proj<2>(pts[i] / pts[i][3]);
+		pts2[i] = Proj<2>(verts[i].Pos / verts[i].Pos[3]);
+		bars.SetCol(i, verts[i].Bar);
 	}
-	clipc = Viewport.Invert() * clipc;
 
 	Vec2f bboxmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
 	Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
@@ -80,21 +235,303 @@ void Triangle(Vec4f* pts, IShader& shader, TGAImage& image, float* zbuffer)
 
 	Vec2i P;
 	TGAColor color;
+	uint64_t tested = 0, depthRejected = 0, shaded = 0;
 	for (P.x = bboxmin.x; P.x <= bboxmax.x; P.x++)
 	{
 		for (P.y = bboxmin.y; P.y <= bboxmax.y; P.y++)
 		{
+			tested++;
 			Vec3f bcScreen = Barycentric(pts2[0], pts2[1], pts2[2], P);
-			Vec3f bcClip = Vec3f(bcScreen.x / pts[0][3], bcScreen.y / pts[1][3], bcScreen.z / pts[2][3]);
+			if (bcScreen.x < 0 || bcScreen.y < 0 || bcScreen.z < 0) continue;
+			Vec3f bcClip = Vec3f(bcScreen.x / verts[0].Pos[3], bcScreen.y / verts[1].Pos[3], bcScreen.z / verts[2].Pos[3]);
 			bcClip = bcClip / (bcClip.x + bcClip.y + bcClip.z);
-			float fragDepth = clipc[2] * bcClip;
-			if (bcScreen.x < 0 || bcScreen.y < 0 || bcScreen.z < 0 || zbuffer[P.x + P.y * image.GetWidth()] > fragDepth) continue;
+			if (clipped) bcClip = bars * bcClip;
+			auto fragDepth = depth.Encode(clipc[2] * bcClip);
+			if (depth.Data[P.x + P.y * image.GetWidth()] > fragDepth) { depthRejected++; continue; }
+			shaded++;
 			bool discard = shader.Fragment(bcClip, color);
 			if (!discard)
 			{
-				zbuffer[P.x + P.y * image.GetWidth()] = fragDepth;
-				image.SetPixel(P.x, P.y, color);
+				depth.Data[P.x + P.y * image.GetWidth()] = fragDepth;
+				image.Set(P.x, P.y, color);
+				recorder.Record(P.x + P.y * image.GetWidth(), bcClip);
+			}
+		}
+	}
+	NANOGL_PROFILE_COUNT(ProfileCounter::PixelsTested, tested);
+	NANOGL_PROFILE_COUNT(ProfileCounter::DepthRejected, depthRejected);
+	NANOGL_PROFILE_COUNT(ProfileCounter::FragmentCalls, shaded);
+}
+
+template<uint8_t BPP, typename Depth, typename Recorder>
+static void RasterizePolygon(const ClipVertex* poly, int count, const Mat<4, 3, float>& clipc, bool clipped, IShader& shader, const TGAImage& image, const Depth& depth, const Recorder& recorder)
+{
+	TGAImageView<BPP> view(image);
+	ClipVertex tri[3] = { poly[0] };
+	for (int i = 1; i + 1 < count; i++)
+	{
+		tri[1] = poly[i];
+		tri[2] = poly[i + 1];
+		RasterizeTriangle(tri, clipc, clipped, shader, view, depth, recorder);
+	}
+}
+
+static void RasterizeTriangle(const ClipVertex* verts, const Mat<4, 3, float>& clipc, bool clipped, IShader& shader, MultisampleImage& image)
+{
+	Mat<3, 2, float> pts2;
+	Mat<3, 3, float> bars;
+	for (int i = 0; i < 3; i++)
+	{
+		pts2[i] = Proj<2>(verts[i].Pos / verts[i].Pos[3]);
+		bars.SetCol(i, verts[i].Bar);
+	}
+
+	// Barycentric coordinates are affine in screen space, so the sample offsets move them by a constant amount
+	const int samples = image.GetSamples();
+	Vec3f sampleDelta[8];
+	Vec3f origin = Barycentric(pts2[0], pts2[1], pts2[2], Vec2f(0, 0));
+	for (int s = 0; s < samples; s++)
+		sampleDelta[s] = Barycentric(pts2[0], pts2[1], pts2[2], image.GetSampleOffset(s)) - origin;
+
+	// Pixels whose samples can reach the triangle
+	Vec2f bboxmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+	Vec2f clamp(image.GetWidth() - 1, image.GetHeight() - 1);
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 2; j++)
+		{
+			bboxmin[j] = std::max(0.0f, std::min(bboxmin[j], std::ceil(pts2[i][j] - 0.5f)));
+			bboxmax[j] = std::min(clamp[j], std::max(bboxmax[j], std::floor(pts2[i][j] + 0.5f)));
+		}
+	}
+
+	Vec2i P;
+	TGAColor color;
+	uint64_t tested = 0, depthRejected = 0, shaded = 0;
+	for (P.x = bboxmin.x; P.x <= bboxmax.x; P.x++)
+	{
+		for (P.y = bboxmin.y; P.y <= bboxmax.y; P.y++)
+		{
+			tested++;
+			Vec3f bcPixel = Barycentric(pts2[0], pts2[1], pts2[2], P);
+			float* depths = image.GetDepth(P.x, P.y);
+			float fragDepth[8];
+			unsigned mask = 0;
+			int shadeSample = -1;
+			for (int s = 0; s < samples; s++)
+			{
+				Vec3f bcScreen = bcPixel + sampleDelta[s];
+				if (bcScreen.x < 0 || bcScreen.y < 0 || bcScreen.z < 0) continue;
+				Vec3f bcClip = Vec3f(bcScreen.x / verts[0].Pos[3], bcScreen.y / verts[1].Pos[3], bcScreen.z / verts[2].Pos[3]);
+				bcClip = bcClip / (bcClip.x + bcClip.y + bcClip.z);
+				if (clipped) bcClip = bars * bcClip;
+				fragDepth[s] = clipc[2] * bcClip;
+				if (depths[s] > fragDepth[s]) { depthRejected++; continue; }
+				mask |= 1u << s;
+				if (shadeSample < 0) shadeSample = s;
 			}
+			if (!mask) continue;
+
+			// Shade at the pixel position when it is covered, otherwise at the first visible sample to avoid extrapolating
+			Vec3f bcScreen = bcPixel;
+			if (bcScreen.x < 0 || bcScreen.y < 0 || bcScreen.z < 0)
+				bcScreen = bcPixel + sampleDelta[shadeSample];
+			Vec3f bcClip = Vec3f(bcScreen.x / verts[0].Pos[3], bcScreen.y / verts[1].Pos[3], bcScreen.z / verts[2].Pos[3]);
+			bcClip = bcClip / (bcClip.x + bcClip.y + bcClip.z);
+			if (clipped) bcClip = bars * bcClip;
+			shaded++;
+			if (shader.Fragment(bcClip, color)) continue;
+
+			uint32_t* colors = image.GetColor(P.x, P.y);
+			for (int s = 0; s < samples; s++)
+			{
+				if (!(mask & (1u << s))) continue;
+				depths[s] = fragDepth[s];
+				colors[s] = color.Val;
+			}
+		}
+	}
+	NANOGL_PROFILE_COUNT(ProfileCounter::PixelsTested, tested);
+	NANOGL_PROFILE_COUNT(ProfileCounter::DepthRejected, depthRejected);
+	NANOGL_PROFILE_COUNT(ProfileCounter::FragmentCalls, shaded);
+}
+
+// Decides from the projected polygon whether it can produce any fragment.
+// sampleReach is how far from the pixel's integer coordinates its samples lie.
+static bool CullPolygon(const ClipVertex* poly, int count, float sampleReach)
+{
+	Vec2f screen[ClipPlaneCount + 3];
+	Vec2f bboxmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+	for (int i = 0; i < count; i++)
+	{
+		screen[i] = Proj<2>(poly[i].Pos / poly[i].Pos[3]);
+		for (int j = 0; j < 2; j++)
+		{
+			bboxmin[j] = std::min(bboxmin[j], screen[i][j]);
+			bboxmax[j] = std::max(bboxmax[j], screen[i][j]);
+		}
+	}
+
+	// Twice the signed area, positive for counter clockwise polygons
+	float area = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const Vec2f& a = screen[i];
+		const Vec2f& b = screen[(i + 1) % count];
+		area += a.x * b.y - a.y * b.x;
+	}
+
+	// Same threshold below which Barycentric() throws every pixel away
+	if (std::abs(area) <= 1e-2 || std::ceil(bboxmin.x - sampleReach) > std::floor(bboxmax.x + sampleReach) || std::ceil(bboxmin.y - sampleReach) > std::floor(bboxmax.y + sampleReach))
+	{
+		Stats.CulledDegenerate++;
+		return true;
+	}
+
+	if (FaceCulling != CullMode::None)
+	{
+		bool front = (area > 0) == (FrontFace == Winding::CounterClockwise);
+		if (front == (FaceCulling == CullMode::Front))
+		{
+			Stats.CulledBackFace++;
+			return true;
 		}
 	}
-}
\ No newline at end of file
+	return false;
+}
+
+// Clips and culls a submitted triangle, returns the vertex count of the polygon left to rasterize or 0
+static int SetupTriangle(const Vec4f* pts, float width, float height, float sampleReach, ClipVertex* poly, bool& clipped, Mat<4, 3, float>& clipc)
+{
+	Stats.Submitted++;
+
+	// Trivially reject triangles that lie outside any one plane of the view volume
+	unsigned outsideAll = ~0u, outsideAny = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		unsigned code = Outcode(pts[i], width, height);
+		outsideAll &= code;
+		outsideAny |= code;
+	}
+	if (outsideAll & ((1u << GuardLeft) - 1))
+	{
+		Stats.CulledOutside++;
+		return 0;
+	}
+
+	// Only the near plane and the guard band are clipped, the image borders are handled by the bounding box
+	ClipVertex polys[2][ClipPlaneCount + 3];
+	int count = 3;
+	for (int i = 0; i < 3; i++)
+	{
+		polys[0][i].Pos = pts[i];
+		polys[0][i].Bar = Vec3f(i == 0, i == 1, i == 2);
+	}
+
+	int current = 0;
+	clipped = false;
+	for (int plane = 0; plane < ClipPlaneCount; plane++)
+	{
+		if (plane >= ClipLeft && plane < GuardLeft) continue;
+		if (!(outsideAny & (1u << plane))) continue;
+		count = ClipPolygon(polys[current], count, polys[1 - current], plane, width, height);
+		current = 1 - current;
+		clipped = true;
+		if (count < 3)
+		{
+			Stats.CulledOutside++;
+			return 0;
+		}
+	}
+
+	if (CullPolygon(polys[current], count, sampleReach))
+		return 0;
+	Stats.Rasterized++;
+
+	for (int i = 0; i < 3; i++) clipc.SetCol(i, pts[i]);
+	clipc = InvertAffine(Viewport) * clipc;
+	std::copy(polys[current], polys[current] + count, poly);
+	return count;
+}
+
+template<typename Depth, typename Recorder>
+static void RasterizeToImage(const ClipVertex* poly, int count, const Mat<4, 3, float>& clipc, bool clipped, IShader& shader, const TGAImage& image, const Depth& depth, const Recorder& recorder)
+{
+	switch (image.GetBytesPerPixel())
+	{
+	case 1: RasterizePolygon<1>(poly, count, clipc, clipped, shader, image, depth, recorder); break;
+	case 3: RasterizePolygon<3>(poly, count, clipc, clipped, shader, image, depth, recorder); break;
+	case 4: RasterizePolygon<4>(poly, count, clipc, clipped, shader, image, depth, recorder); break;
+	}
+}
+
+void Triangle(Vec4f* pts, IShader& shader, TGAImage& image, float* zbuffer)
+{
+	ClipVertex poly[ClipPlaneCount + 3];
+	bool clipped;
+	Mat<4, 3, float> clipc;
+	int count = SetupTriangle(pts, image.GetWidth(), image.GetHeight(), 0.0f, poly, clipped, clipc);
+	if (count)
+		RasterizeToImage(poly, count, clipc, clipped, shader, image, FloatDepthView{ zbuffer }, NoVisibility());
+}
+
+template<typename Recorder>
+static void RasterizeToDepthBuffer(Vec4f* pts, IShader& shader, TGAImage& image, DepthBuffer& depth, const Recorder& recorder)
+{
+	ClipVertex poly[ClipPlaneCount + 3];
+	bool clipped;
+	Mat<4, 3, float> clipc;
+	int count = SetupTriangle(pts, image.GetWidth(), image.GetHeight(), 0.0f, poly, clipped, clipc);
+	if (!count)
+		return;
+
+	Vec2f bboxmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+	for (int i = 0; i < count; i++)
+	{
+		Vec2f p = Proj<2>(poly[i].Pos / poly[i].Pos[3]);
+		for (int j = 0; j < 2; j++)
+		{
+			bboxmin[j] = std::min(bboxmin[j], p[j]);
+			bboxmax[j] = std::max(bboxmax[j], p[j]);
+		}
+	}
+	// The guard band keeps the coordinates well inside the int range
+	depth.Touch((int)std::floor(bboxmin.x), (int)std::floor(bboxmin.y), (int)std::ceil(bboxmax.x), (int)std::ceil(bboxmax.y));
+	switch (depth.GetFormat())
+	{
+	case DepthFormat::Float32: RasterizeToImage(poly, count, clipc, clipped, shader, image, depth.GetFloatView(), recorder); break;
+	case DepthFormat::Unorm24: RasterizeToImage(poly, count, clipc, clipped, shader, image, depth.GetUnorm24View(), recorder); break;
+	case DepthFormat::Unorm16: RasterizeToImage(poly, count, clipc, clipped, shader, image, depth.GetUnorm16View(), recorder); break;
+	}
+}
+
+void Triangle(Vec4f* pts, IShader& shader, TGAImage& image, DepthBuffer& depth)
+{
+	RasterizeToDepthBuffer(pts, shader, image, depth, NoVisibility());
+}
+
+void Triangle(Vec4f* pts, IShader& shader, TGAImage& image, DepthBuffer& depth, VisibilitySample* visibility, int face, int instance)
+{
+	RasterizeToDepthBuffer(pts, shader, image, depth, VisibilityRecorder{ visibility, face, instance });
+}
+
+void Triangle(Vec4f* pts, IShader& shader, MultisampleImage& image)
+{
+	ClipVertex poly[ClipPlaneCount + 3];
+	bool clipped;
+	Mat<4, 3, float> clipc;
+	int count = SetupTriangle(pts, image.GetWidth(), image.GetHeight(), 0.5f, poly, clipped, clipc);
+	if (!count)
+		return;
+
+	ClipVertex tri[3] = { poly[0] };
+	for (int i = 1; i + 1 < count; i++)
+	{
+		tri[1] = poly[i];
+		tri[2] = poly[i + 1];
+		RasterizeTriangle(tri, clipc, clipped, shader, image);
+	}
+}
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <cstdint>
+
 #include "tgaimage.h"
 #include "geometry.h"
+#include "multisample.h"
+#include "depthbuffer.h"
 
 extern Mat4x4 ModelView;
 extern Mat4x4 Viewport;
@@ -12,6 +16,43 @@ void CreateViewportMatrix(int x, int y, int w, int h);
 void CreateProjectionMatrix(float coeff = 0.0f);	// coeff = -1/c
 void LookAt(Vec3f eye, Vec3f center, Vec3f up);
 
+enum class CullMode { None, Back, Front };
+enum class Winding { CounterClockwise, Clockwise };
+
+// Faces are classified by their winding on screen (x right, y up) after clipping
+void SetCullMode(CullMode mode, Winding frontFace = Winding::CounterClockwise);
+
+struct RasterStats
+{
+	uint64_t Submitted = 0;
+	uint64_t CulledOutside = 0;		// outside the view volume or clipped away
+	uint64_t CulledBackFace = 0;
+	uint64_t CulledDegenerate = 0;	// zero area or covering no pixel
+	uint64_t Rasterized = 0;
+	uint64_t ClustersTested = 0;
+	uint64_t ClustersOutside = 0;
+	uint64_t ClustersBackFacing = 0;
+	uint64_t CulledByCluster = 0;	// skipped with their cluster, not counted as submitted
+
+	uint64_t Culled() const { return CulledOutside + CulledBackFace + CulledDegenerate; }
+};
+
+RasterStats& GetRasterStats();
+void ResetRasterStats();
+
+enum class Visibility { Outside, Intersecting, Inside };
+
+// Classifies an object space box against the view volume of the current ModelView, Projection and Viewport.
+// Conservative: a box that is reported Intersecting may still turn out to be invisible.
+Visibility TestBox(const Vec3f& boundsMin, const Vec3f& boundsMax, int width, int height);
+
+// Homogeneous object space position of the viewer of the current matrices, w is 0 for orthographic projections
+Vec4f GetViewer();
+
+// True when the current cull mode rejects every face whose normal lies in the cone, for faces inside the sphere.
+// cutoff is the sine of the cone half angle as stored in Meshlet.
+bool TestCone(const Vec4f& viewer, const Vec3f& center, float radius, const Vec3f& axis, float cutoff);
+
 struct IShader
 {
 	virtual ~IShader();
@@ -19,4 +60,18 @@ struct IShader
 	virtual bool Fragment(Vec3f bar, TGAColor& color) = 0;
 };
 
-void Triangle(Vec4f* pts, IShader& shader, TGAImage& image, float* zbuffer);
\ No newline at end of file
+// The fragment a pixel was last written by, Face is -1 for pixels nothing was written to
+struct VisibilitySample
+{
+	int Face;
+	int Instance;
+	Vec3f Bar;	// Perspective correct barycentrics as passed to IShader::Fragment()
+};
+
+void Triangle(Vec4f* pts, IShader& shader, TGAImage& image, float* zbuffer);
+// Fills the cleared depth tiles under the triangle before rasterizing it
+void Triangle(Vec4f* pts, IShader& shader, TGAImage& image, DepthBuffer& depth);
+// Also stores face, instance and the barycentrics of every written fragment in visibility, which has one sample per pixel
+void Triangle(Vec4f* pts, IShader& shader, TGAImage& image, DepthBuffer& depth, VisibilitySample* visibility, int face, int instance = 0);
+// Depth tested per sample, the fragment shader runs once per pixel for the covered samples
+void Triangle(Vec4f* pts, IShader& shader, MultisampleImage& image);
\ No newline at end of file
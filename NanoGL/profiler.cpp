@@ -0,0 +1,50 @@
+#include "profiler.h"
+
+#include <fstream>
+#include <iostream>
+
+static const char* const passNames[] = { "ao_raster", "ao_horizon", "shadow_map", "final_shading", "image_write" };
+static const char* const counterNames[] = { "triangles_submitted", "triangles_culled", "triangles_rasterized", "pixels_tested", "depth_rejected", "fragment_calls" };
+
+Profiler& Profiler::Get()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Profiler()
+{
+	for (std::atomic<int64_t>& time : m_Times) time = 0;
+	for (std::atomic<uint64_t>& counter : m_Counters) counter = 0;
+	m_FrameStart = std::chrono::steady_clock::now();
+}
+
+void Profiler::BeginFrame()
+{
+	for (std::atomic<int64_t>& time : m_Times) time = 0;
+	for (std::atomic<uint64_t>& counter : m_Counters) counter = 0;
+	m_FrameStart = std::chrono::steady_clock::now();
+}
+
+bool Profiler::EndFrame(const char* filename)
+{
+	std::chrono::duration<double, std::milli> frameTime = std::chrono::steady_clock::now() - m_FrameStart;
+
+	std::ofstream out(filename, std::ios::app);
+	if (!out.is_open())
+	{
+		std::cerr << "Can't open file " << filename << std::endl;
+		return false;
+	}
+
+	out << "{\"frame\":" << m_Frame++ << ",\"frame_ms\":" << frameTime.count() << ",\"passes_ms\":{";
+	for (int i = 0; i < (int)ProfilePass::Count; i++)
+		out << (i ? "," : "") << "\"" << passNames[i] << "\":" << m_Times[i] / 1e6;
+	out << "},\"counters\":{";
+	for (int i = 0; i < (int)ProfileCounter::Count; i++)
+		out << (i ? "," : "") << "\"" << counterNames[i] << "\":" << m_Counters[i];
+	out << "}}\n";
+
+	BeginFrame();
+	return out.good();
+}
\ No newline at end of file
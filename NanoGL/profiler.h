@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Pass timings and pipeline counters, collected when the project is built with NANOGL_PROFILING defined.
+// Without it the NANOGL_PROFILE_* macros expand to nothing and the hot paths are unchanged.
+
+enum class ProfilePass { AORaster, AOHorizon, ShadowMap, FinalShading, ImageWrite, Count };
+enum class ProfileCounter { TrianglesSubmitted, TrianglesCulled, TrianglesRasterized, PixelsTested, DepthRejected, FragmentCalls, Count };
+
+// Process wide, times and counters may be added from any thread
+class Profiler
+{
+public:
+	static Profiler& Get();
+
+	void BeginFrame();
+	bool EndFrame(const char* filename);	// Appends the frame to the file as one line of JSON and resets the totals
+
+	void AddTime(ProfilePass pass, std::chrono::steady_clock::duration time)
+	{
+		m_Times[(int)pass].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count(), std::memory_order_relaxed);
+	}
+
+	void Add(ProfileCounter counter, uint64_t n)
+	{
+		m_Counters[(int)counter].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	double GetTime(ProfilePass pass) const { return m_Times[(int)pass] / 1e6; }	// milliseconds since BeginFrame()
+	uint64_t GetCount(ProfileCounter counter) const { return m_Counters[(int)counter]; }
+private:
+	Profiler();
+private:
+	std::atomic<int64_t> m_Times[(int)ProfilePass::Count];	// nanoseconds
+	std::atomic<uint64_t> m_Counters[(int)ProfileCounter::Count];
+	std::chrono::steady_clock::time_point m_FrameStart;
+	uint64_t m_Frame = 0;
+};
+
+class ProfileScope
+{
+public:
+	explicit ProfileScope(ProfilePass pass) : m_Pass(pass), m_Start(std::chrono::steady_clock::now()) {}
+	~ProfileScope() { Profiler::Get().AddTime(m_Pass, std::chrono::steady_clock::now() - m_Start); }
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+private:
+	ProfilePass m_Pass;
+	std::chrono::steady_clock::time_point m_Start;
+};
+
+#ifdef NANOGL_PROFILING
+#define NANOGL_PROFILE_CONCAT_IMPL(a, b) a##b
+#define NANOGL_PROFILE_CONCAT(a, b) NANOGL_PROFILE_CONCAT_IMPL(a, b)
+#define NANOGL_PROFILE_SCOPE(pass) ProfileScope NANOGL_PROFILE_CONCAT(profileScope, __LINE__)(pass)
+#define NANOGL_PROFILE_COUNT(counter, n) Profiler::Get().Add(counter, n)
+#define NANOGL_PROFILE_BEGIN_FRAME() Profiler::Get().BeginFrame()
+#define NANOGL_PROFILE_END_FRAME(filename) Profiler::Get().EndFrame(filename)
+#else
+#define NANOGL_PROFILE_SCOPE(pass) ((void)(pass))
+#define NANOGL_PROFILE_COUNT(counter, n) ((void)(n))
+#define NANOGL_PROFILE_BEGIN_FRAME() ((void)0)
+#define NANOGL_PROFILE_END_FRAME(filename) ((void)0)
+#endif
\ No newline at end of file
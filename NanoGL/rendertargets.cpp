@@ -0,0 +1,81 @@
+#include "rendertargets.h"
+
+void RenderTargetPool::BeginFrame()
+{
+	for (auto& target : m_Targets)
+		target->InUse = false;
+}
+
+RenderTargetPool::Target& RenderTargetPool::Acquire(int width, int height, int format, size_t size)
+{
+	for (auto& target : m_Targets)
+	{
+		if (!target->InUse && target->Width == width && target->Height == height && target->Format == format)
+		{
+			target->InUse = true;
+			return *target;
+		}
+	}
+
+	std::unique_ptr<Target> target(new Target());
+	target->Width = width;
+	target->Height = height;
+	target->Format = format;
+	target->Size = size;
+	if (format > 0)
+	{
+		target->Allocation.reset(new uint8_t[size + Alignment - 1]);
+		target->Memory = (uint8_t*)(((uintptr_t)target->Allocation.get() + Alignment - 1) & ~(uintptr_t)(Alignment - 1));
+		target->Image = TGAImage(target->Memory, (uint16_t)width, (uint16_t)height, (uint8_t)format);
+	}
+	else
+	{
+		target->Memory = nullptr;
+		target->Depth = DepthBuffer(width, height, (DepthFormat)(-1 - format));
+	}
+	target->InUse = true;
+	m_Allocations++;
+
+	m_Targets.push_back(std::move(target));
+	return *m_Targets.back();
+}
+
+TGAImage& RenderTargetPool::AcquireImage(int width, int height, uint8_t bytesPerPixel)
+{
+	Target& target = Acquire(width, height, bytesPerPixel, (size_t)width * height * bytesPerPixel);
+	target.Image.Clear();
+	return target.Image;
+}
+
+DepthBuffer& RenderTargetPool::AcquireDepth(int width, int height, DepthFormat format)
+{
+	Target& target = Acquire(width, height, -1 - (int)format, (size_t)width * height * (format == DepthFormat::Unorm16 ? 2 : 4));
+	target.Depth.Clear();
+	return target.Depth;
+}
+
+void RenderTargetPool::Release(const TGAImage& image)
+{
+	for (auto& target : m_Targets)
+	{
+		if (&target->Image == &image)
+			target->InUse = false;
+	}
+}
+
+void RenderTargetPool::Release(const DepthBuffer& depth)
+{
+	for (auto& target : m_Targets)
+	{
+		if (&target->Depth == &depth)
+			target->InUse = false;
+	}
+}
+
+size_t RenderTargetPool::GetMemorySize() const
+{
+	size_t size = 0;
+	for (const auto& target : m_Targets)
+		size += target->Size;
+	return size;
+}
\ No newline at end of file
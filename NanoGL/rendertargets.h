@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "tgaimage.h"
+#include "depthbuffer.h"
+
+// Color, AO and depth buffers that are reused from frame to frame.
+// Targets are handed out by size and format, BeginFrame() takes all of them back and the next frame
+// gets the same memory again, so once the first frame has been rendered no more heap allocations are made.
+class RenderTargetPool
+{
+public:
+	static const size_t Alignment = 64;
+
+	RenderTargetPool() = default;
+
+	RenderTargetPool(const RenderTargetPool&) = delete;
+	RenderTargetPool& operator=(const RenderTargetPool&) = delete;
+
+	// Makes every target available again, the ones acquired before must not be used anymore
+	void BeginFrame();
+
+	// Zeroed image wrapping pool memory, it must not be moved from
+	TGAImage& AcquireImage(int width, int height, uint8_t bytesPerPixel);
+	// Depth buffer cleared to the farthest depth, the clear itself is deferred to the tiles that get drawn to
+	DepthBuffer& AcquireDepth(int width, int height, DepthFormat format = DepthFormat::Float32);
+
+	// Hands a single target back before the end of the frame
+	void Release(const TGAImage& image);
+	void Release(const DepthBuffer& depth);
+
+	uint64_t GetAllocationCount() const { return m_Allocations; }	// Heap allocations made for target memory
+	size_t GetMemorySize() const;
+private:
+	struct Target
+	{
+		int Width, Height;
+		int Format;		// Bytes per pixel of images, -1 - DepthFormat of depth buffers
+		size_t Size;
+		std::unique_ptr<uint8_t[]> Allocation;
+		uint8_t* Memory;	// Aligned start of Allocation
+		TGAImage Image;
+		DepthBuffer Depth;
+		bool InUse;
+	};
+
+	Target& Acquire(int width, int height, int format, size_t size);
+private:
+	std::vector<std::unique_ptr<Target>> m_Targets;
+	uint64_t m_Allocations = 0;
+};
\ No newline at end of file
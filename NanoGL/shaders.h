@@ -2,6 +2,7 @@
 
 #include "nanogl.h"
 #include "model.h"
+#include "fastmath.h"
 
 struct ZShader : public IShader
 {
@@ -34,11 +35,12 @@ struct Shader : public IShader
 	Mat<4, 4, float> uniformMshadow; // transform framebuffer screen coordinates to shadowbuffer screen coordinates
 	Vec3f uniformLight;
 	const Model& uniformModel;
-	const float* const uniformShadowBuffer;
+	const DepthBuffer* const uniformShadowBuffer;
 	const TGAImage* const uniformAOImage;
+	const MathPrecision uniformPrecision;
 
-	Shader(const Mat4x4& M, const Mat4x4& MIT, const Mat4x4& Mshadow, const Model& model, const Vec3f& light, const float* const shadowBuffer, const TGAImage* const AOImage)
-		: uniformM(M), uniformMIT(MIT), uniformMshadow(Mshadow), uniformModel(model), uniformShadowBuffer(shadowBuffer), uniformAOImage(AOImage)
+	Shader(const Mat4x4& M, const Mat4x4& MIT, const Mat4x4& Mshadow, const Model& model, const Vec3f& light, const DepthBuffer* const shadowBuffer, const TGAImage* const AOImage, MathPrecision precision = MathPrecision::Exact)
+		: uniformM(M), uniformMIT(MIT), uniformMshadow(Mshadow), uniformModel(model), uniformShadowBuffer(shadowBuffer), uniformAOImage(AOImage), uniformPrecision(precision)
 	{
 		uniformLight = Proj<3>(uniformM * Embed<4>(light)).Normalize(); // light vector
 	}
@@ -53,14 +55,26 @@ struct Shader : public IShader
 	}
 
 	virtual bool Fragment(Vec3f bar, TGAColor& color)
+	{
+		switch (uniformPrecision)
+		{
+		case MathPrecision::Medium: return Shade<MathPrecision::Medium>(bar, color);
+		case MathPrecision::Fast: return Shade<MathPrecision::Fast>(bar, color);
+		default: return Shade<MathPrecision::Exact>(bar, color);
+		}
+	}
+
+	template<MathPrecision P>
+	bool Shade(Vec3f bar, TGAColor& color)
 	{
 		Vec4f sbP = uniformMshadow * Embed<4>(varyingTri * bar); // corresponding point in the shadow buffer
 		sbP = sbP / sbP[3];
-		int idx = std::max(0,int(sbP[0])) + std::max(0,int(sbP[1])) * uniformAOImage->GetWidth(); // index in the shadowbuffer array
-		float shadow = .3 + .7 * (uniformShadowBuffer[idx] < sbP[2] + 43.34);
+		int sbX = std::min(std::max(0, int(sbP[0])), uniformShadowBuffer->GetWidth() - 1);
+		int sbY = std::min(std::max(0, int(sbP[1])), uniformShadowBuffer->GetHeight() - 1);
+		float shadow = .3 + .7 * (uniformShadowBuffer->GetDepth(sbX, sbY) < sbP[2] + 43.34);
 
 		// Tangent Normal Calculations
-		Vec3f bn = (varyingNorm * bar).Normalize();
+		Vec3f bn = FastNormalize<P>(varyingNorm * bar);
 		Mat<3, 3, float> A;
 		A[0] = varyingTri.Col(1) - varyingTri.Col(0);
 		A[1] = varyingTri.Col(2) - varyingTri.Col(0);
@@ -71,14 +85,14 @@ struct Shader : public IShader
 		Vec3f j = AI * Vec3f(varyingUV[1][1] - varyingUV[1][0], varyingUV[1][2] - varyingUV[1][0], 0);
 
 		Mat<3, 3, float> B;
-		B.SetCol(0, i.Normalize());
-		B.SetCol(1, j.Normalize());
+		B.SetCol(0, FastNormalize<P>(i));
+		B.SetCol(1, FastNormalize<P>(j));
 		B.SetCol(2, bn);
 
 		Vec2f uv = varyingUV * bar;                 // interpolate uv for the current pixel
-		Vec3f n = (B * uniformModel.SampleNormalMap(uv)).Normalize(); // normal
-		Vec3f r = (n * (n * uniformLight * 2.f) - uniformLight).Normalize();   // reflected light
-		float spec = pow(std::max(r.z, 0.0f), uniformModel.SampleSpecularMap(uv));
+		Vec3f n = FastNormalize<P>(B * uniformModel.SampleNormalMap(uv)); // normal
+		Vec3f r = FastNormalize<P>(n * (n * uniformLight * 2.f) - uniformLight);   // reflected light
+		float spec = P == MathPrecision::Exact ? pow(std::max(r.z, 0.0f), uniformModel.SampleSpecularMap(uv)) : FastPow<P>(std::max(r.z, 0.0f), uniformModel.SampleSpecularMap(uv));
 		float diff = std::max(0.f, n * uniformLight);
 		TGAColor c = uniformModel.SampleDiffuseMap(uv);
 		TGAColor glowColor = uniformModel.SampleGlowMap(uv);
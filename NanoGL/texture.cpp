@@ -0,0 +1,84 @@
+#include "texture.h"
+
+Texture::Texture()
+	: m_Texels(16, 0)
+{
+}
+
+Texture::Texture(const TGAImage& img, TextureFormat format)
+{
+	Load(img, format);
+}
+
+void Texture::Load(const TGAImage& img, TextureFormat format)
+{
+	m_Width = img.GetBuffer() ? img.GetWidth() : 0;
+	m_Height = img.GetBuffer() ? img.GetHeight() : 0;
+	m_MaxX = std::max(m_Width - 1, 0);
+	m_MaxY = std::max(m_Height - 1, 0);
+	m_TilesX = std::max((m_Width + 3) >> 2, 1);
+	m_TilesY = std::max((m_Height + 3) >> 2, 1);
+	m_Format = TextureFormat::BGRA8;
+	m_Blocks.clear();
+
+	m_Texels.assign((size_t)m_TilesX * m_TilesY * 16, 0);
+	if (IsEmpty())
+		return;
+
+	switch (img.GetBytesPerPixel())
+	{
+	case 1: ConvertTexels(TGAViewR8(img)); break;
+	case 3: ConvertTexels(TGAViewRGB8(img)); break;
+	case 4: ConvertTexels(TGAViewRGBA8(img)); break;
+	}
+
+	if (format != TextureFormat::BGRA8)
+	{
+		m_Format = format;
+		CompressTexels();
+	}
+}
+
+template<uint8_t BPP>
+void Texture::ConvertTexels(const TGAImageView<BPP>& src)
+{
+	for (int y = 0; y < m_Height; y++)
+	{
+		const uint8_t* row = src.Row(y);
+		for (int x = 0; x < m_Width; x++, row += BPP)
+		{
+			TGAColor c;
+			if (BPP == 1) c = TGAColor(row[0], row[0], row[0]);
+			else if (BPP == 3) c = TGAColor(row[2], row[1], row[0]);
+			else c = TGAColor(row, BPP);
+			m_Texels[TexelIndex(x, y)] = c.Val;
+		}
+	}
+}
+
+void Texture::CompressTexels()
+{
+	m_Blocks.resize((size_t)m_TilesX * m_TilesY * (m_Format == TextureFormat::BC5 ? 2 : 1));
+	uint32_t texels[16];
+	for (int ty = 0; ty < m_TilesY; ty++)
+	{
+		for (int tx = 0; tx < m_TilesX; tx++)
+		{
+			// Tiles on the right and top edge repeat the edge texels instead of encoding the padding
+			for (int i = 0; i < 16; i++)
+				texels[i] = m_Texels[TexelIndex(std::min(tx * 4 + (i & 3), m_MaxX), std::min(ty * 4 + (i >> 2), m_MaxY))];
+
+			size_t block = (size_t)ty * m_TilesX + tx;
+			switch (m_Format)
+			{
+			case TextureFormat::BC1: m_Blocks[block] = EncodeBC1(texels); break;
+			case TextureFormat::BC4: m_Blocks[block] = EncodeBC4(texels, 0); break;
+			default:
+				m_Blocks[block * 2] = EncodeBC4(texels, 2);
+				m_Blocks[block * 2 + 1] = EncodeBC4(texels, 1);
+				break;
+			}
+		}
+	}
+	std::vector<uint32_t>().swap(m_Texels);
+}
\ No newline at end of file
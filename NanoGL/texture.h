@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "blockcompression.h"
+#include "tgaimage.h"
+
+// In-memory storage of a texture, the block compressed formats are decoded when sampled.
+//  BGRA8: 4 bytes per texel, exact.
+//  BC1:   0.5 bytes per texel, color maps without alpha.
+//  BC4:   0.5 bytes per texel, single channel maps (the blue channel, which is gray in grayscale maps), sampled as gray.
+//  BC5:   1 byte per texel, tangent space normal maps. Red and green are kept, blue is rebuilt from unit length.
+enum class TextureFormat { BGRA8, BC1, BC4, BC5 };
+
+// Read-only copy of a TGAImage used for sampling.
+// Texels are normalized to 32-bit BGRA (the TGAColor layout) and stored in 4x4 tiles,
+// so texels that are close in v are close in memory as well. The compressed formats store one block per tile.
+class Texture
+{
+public:
+	Texture();
+	explicit Texture(const TGAImage& img, TextureFormat format = TextureFormat::BGRA8);
+
+	void Load(const TGAImage& img, TextureFormat format = TextureFormat::BGRA8);
+
+	// Coordinates are clamped to the edge, an empty texture always returns TGAColor()
+	TGAColor Fetch(int x, int y) const
+	{
+		x = std::min(std::max(x, 0), m_MaxX);
+		y = std::min(std::max(y, 0), m_MaxY);
+		if (m_Format == TextureFormat::BGRA8)
+			return TGAColor(m_Texels[TexelIndex(x, y)]);
+
+		size_t block = (size_t)(y >> 2) * m_TilesX + (x >> 2);
+		int i = ((y & 3) << 2) + (x & 3);
+		switch (m_Format)
+		{
+		case TextureFormat::BC1: return TGAColor(DecodeBC1(m_Blocks[block], i));
+		case TextureFormat::BC4: { uint8_t v = DecodeBC4(m_Blocks[block], i); return TGAColor(v, v, v); }
+		default: return TGAColor(DecodeBC5Normal(&m_Blocks[block * 2], i));
+		}
+	}
+
+	TGAColor Sample(float u, float v) const { return Fetch(int(u * m_Width), int(v * m_Height)); }
+
+	int GetWidth() const { return m_Width; }
+	int GetHeight() const { return m_Height; }
+	bool IsEmpty() const { return m_Width == 0 || m_Height == 0; }
+	TextureFormat GetFormat() const { return m_Format; }
+	size_t GetMemorySize() const { return m_Texels.size() * sizeof(uint32_t) + m_Blocks.size() * sizeof(uint64_t); }
+private:
+	template<uint8_t BPP> void ConvertTexels(const TGAImageView<BPP>& src);
+	void CompressTexels();
+
+	size_t TexelIndex(int x, int y) const
+	{
+		return (((size_t)(y >> 2) * m_TilesX + (x >> 2)) << 4) + ((y & 3) << 2) + (x & 3);
+	}
+private:
+	int m_Width = 0, m_Height = 0;
+	int m_MaxX = 0, m_MaxY = 0;
+	int m_TilesX = 1, m_TilesY = 1;
+	TextureFormat m_Format = TextureFormat::BGRA8;
+	std::vector<uint32_t> m_Texels;
+	std::vector<uint64_t> m_Blocks;	// Compressed formats only, BC5 has two per tile
+};
@@ -0,0 +1,146 @@
+#include "texturecache.h"
+
+#include <climits>
+#include <cstdlib>
+#include <sys/stat.h>
+
+// Canonical path, modification time and size of an existing file
+static bool GetFileIdentity(const std::string& filename, std::string& path, int64_t& modifiedTime, int64_t& fileSize)
+{
+#ifdef _WIN32
+	char buffer[_MAX_PATH];
+	if (!_fullpath(buffer, filename.c_str(), _MAX_PATH))
+		return false;
+	struct _stat64 info;
+	if (_stat64(buffer, &info) != 0)
+		return false;
+#else
+	char buffer[PATH_MAX];
+	if (!realpath(filename.c_str(), buffer))
+		return false;
+	struct stat info;
+	if (stat(buffer, &info) != 0)
+		return false;
+#endif
+	path = buffer;
+	modifiedTime = (int64_t)info.st_mtime;
+	fileSize = (int64_t)info.st_size;
+	return true;
+}
+
+TextureCache& TextureCache::Get()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+std::shared_ptr<const Texture> TextureCache::GetEmptyTexture()
+{
+	static const std::shared_ptr<const Texture> empty = std::make_shared<const Texture>();
+	return empty;
+}
+
+std::shared_ptr<const Texture> TextureCache::Load(const std::string& filename, bool flipVertical, TextureFormat format)
+{
+	std::string path;
+	int64_t modifiedTime, fileSize;
+	if (!GetFileIdentity(filename, path, modifiedTime, fileSize))
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Statistics.Misses++;
+		return GetEmptyTexture();
+	}
+
+	static const char* const formatNames[] = { "", "|bc1", "|bc4", "|bc5" };
+	std::string key = (flipVertical ? path + "|flipped" : path) + formatNames[(int)format];
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto it = m_Index.find(key);
+		if (it != m_Index.end() && it->second->ModifiedTime == modifiedTime && it->second->FileSize == fileSize)
+		{
+			m_Statistics.Hits++;
+			m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+			return it->second->Handle;
+		}
+		m_Statistics.Misses++;
+	}
+
+	// Read without holding the lock, so other threads are served meanwhile
+	TGAImage img;
+	if (!img.ReadTGAImage(path.c_str()))
+		return GetEmptyTexture();
+	if (flipVertical)
+		img.FlipVertical();
+	std::shared_ptr<const Texture> texture = std::make_shared<const Texture>(img, format);
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	auto it = m_Index.find(key);
+	if (it != m_Index.end())
+	{
+		// Another thread read the same file in the meantime, its copy is the one shared
+		if (it->second->ModifiedTime == modifiedTime && it->second->FileSize == fileSize)
+		{
+			m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+			return it->second->Handle;
+		}
+		Remove(it->second);
+	}
+	size_t size = texture->GetMemorySize();
+	m_Entries.push_front(Entry{ key, modifiedTime, fileSize, texture, size });
+	m_Index[key] = m_Entries.begin();
+	m_Statistics.ResidentBytes += size;
+	m_Statistics.ResidentTextures++;
+	Evict();
+	return texture;
+}
+
+void TextureCache::Remove(std::list<Entry>::iterator entry)
+{
+	m_Statistics.ResidentBytes -= entry->Size;
+	m_Statistics.ResidentTextures--;
+	m_Index.erase(entry->Key);
+	m_Entries.erase(entry);
+}
+
+// Drops unused textures from the least recently used end until the budget is met
+void TextureCache::Evict()
+{
+	auto it = m_Entries.end();
+	while (m_Statistics.ResidentBytes > m_Budget && it != m_Entries.begin())
+	{
+		--it;
+		if (it->Handle.use_count() > 1)
+			continue;
+		auto evicted = it++;
+		Remove(evicted);
+		m_Statistics.Evictions++;
+	}
+}
+
+void TextureCache::SetBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Budget = bytes;
+	Evict();
+}
+
+size_t TextureCache::GetBudget() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Budget;
+}
+
+TextureCache::Statistics TextureCache::GetStatistics() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Statistics;
+}
+
+void TextureCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Entries.clear();
+	m_Index.clear();
+	m_Statistics.ResidentBytes = 0;
+	m_Statistics.ResidentTextures = 0;
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "texture.h"
+
+// Process wide cache of the textures models load from TGA files.
+// Files are identified by canonical path, modification time and size, and cached once per format, so models referencing the same file share one
+// immutable Texture and a file changed on disk is read again. Textures no model holds any more stay cached until the
+// cache exceeds its memory budget, then the least recently used of them are evicted. Textures still in use are never
+// evicted and count against the budget too. All members are thread safe.
+class TextureCache
+{
+public:
+	struct Statistics
+	{
+		uint64_t Hits = 0;
+		uint64_t Misses = 0;		// Loads from disk, failed ones included
+		uint64_t Evictions = 0;
+		size_t ResidentBytes = 0;	// Texel memory of the cached textures
+		size_t ResidentTextures = 0;
+	};
+
+	static TextureCache& Get();
+	// Shared by everything that has no texture, samples as TGAColor()
+	static std::shared_ptr<const Texture> GetEmptyTexture();
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// Texture of the TGA file, flipped vertically when asked and compressed to the format on a miss.
+	// Files that can't be read give the empty texture.
+	std::shared_ptr<const Texture> Load(const std::string& filename, bool flipVertical = false, TextureFormat format = TextureFormat::BGRA8);
+
+	void SetBudget(size_t bytes);	// 512 MB by default
+	size_t GetBudget() const;
+	Statistics GetStatistics() const;
+	// Forgets every cached texture, handles given out stay valid
+	void Clear();
+private:
+	TextureCache() = default;
+
+	struct Entry
+	{
+		std::string Key;
+		int64_t ModifiedTime;
+		int64_t FileSize;
+		std::shared_ptr<const Texture> Handle;
+		size_t Size;
+	};
+
+	void Remove(std::list<Entry>::iterator entry);
+	void Evict();
+private:
+	mutable std::mutex m_Mutex;
+	std::list<Entry> m_Entries;		// Most recently used first
+	std::unordered_map<std::string, std::list<Entry>::iterator> m_Index;
+	size_t m_Budget = (size_t)512 << 20;
+	Statistics m_Statistics;
+};
\ No newline at end of file
@@ -1,15 +1,18 @@
 #include "tgaimage.h"
 
+#include <algorithm>
 #include <iostream>
 #include <cstring>
+#include <vector>
 
 TGAImage::~TGAImage()
 {
-	delete[] m_Data;
+	if (m_OwnsData)
+		delete[] m_Data;
 }
 
 TGAImage::TGAImage()
-	: m_Width(0), m_Height(0), m_BytesPerPixel(0), m_Data(nullptr)
+	: m_Width(0), m_Height(0), m_BytesPerPixel(0), m_Data(nullptr), m_Origin(nullptr), m_Stride(0)
 {
 }
 
@@ -19,13 +22,62 @@ TGAImage::TGAImage(uint16_t width, uint16_t height, uint8_t bytesPerPixel)
 	unsigned long nbytes = width * height * bytesPerPixel;
 	m_Data = new uint8_t[nbytes];
 	memset(m_Data, 0, nbytes);
+	m_Origin = m_Data;
+	m_Stride = width * bytesPerPixel;
+}
+
+TGAImage::TGAImage(uint8_t* data, uint16_t width, uint16_t height, uint8_t bytesPerPixel, bool topDown)
+	: m_Width(width), m_Height(height), m_BytesPerPixel(bytesPerPixel), m_Data(data), m_Origin(data), m_Stride(width * bytesPerPixel), m_OwnsData(false)
+{
+	if (topDown)
+		FlipVertical();
+}
+
+TGAImage::TGAImage(const TGAImage& img)
+	: m_Width(img.m_Width), m_Height(img.m_Height), m_BytesPerPixel(img.m_BytesPerPixel), m_Data(nullptr), m_Origin(nullptr), m_Stride(img.m_Stride)
+{
+	if (img.m_Data)
+	{
+		size_t nbytes = (size_t)m_Width * m_Height * m_BytesPerPixel;
+		m_Data = new uint8_t[nbytes];
+		memcpy(m_Data, img.m_Data, nbytes);
+		m_Origin = m_Data + (img.m_Origin - img.m_Data);
+	}
+}
+
+TGAImage::TGAImage(TGAImage&& img)
+	: m_Width(img.m_Width), m_Height(img.m_Height), m_BytesPerPixel(img.m_BytesPerPixel), m_Data(img.m_Data), m_Origin(img.m_Origin), m_Stride(img.m_Stride), m_OwnsData(img.m_OwnsData)
+{
+	img.m_Width = img.m_Height = img.m_BytesPerPixel = 0;
+	img.m_Data = img.m_Origin = nullptr;
+	img.m_Stride = 0;
+	img.m_OwnsData = true;
+}
+
+TGAImage& TGAImage::operator=(const TGAImage& img)
+{
+	if (this != &img)
+		*this = TGAImage(img);
+	return *this;
+}
+
+TGAImage& TGAImage::operator=(TGAImage&& img)
+{
+	std::swap(m_Width, img.m_Width);
+	std::swap(m_Height, img.m_Height);
+	std::swap(m_BytesPerPixel, img.m_BytesPerPixel);
+	std::swap(m_Data, img.m_Data);
+	std::swap(m_Origin, img.m_Origin);
+	std::swap(m_Stride, img.m_Stride);
+	std::swap(m_OwnsData, img.m_OwnsData);
+	return *this;
 }
 
 bool TGAImage::ReadTGAImage(const char* filename)
 {
-	// Open the file
+	// Pull the whole file in with a single read, the decoder then works on memory
 	std::ifstream in;
-	in.open(filename, std::ios::binary);
+	in.open(filename, std::ios::binary | std::ios::ate);
 	if (!in.is_open())
 	{
 		std::cerr << "Error opening file " << filename << "\n";
@@ -33,63 +85,101 @@ bool TGAImage::ReadTGAImage(const char* filename)
 		return false;
 	}
 
+	std::streamoff fileSize = in.tellg();
+	std::vector<uint8_t> file(fileSize > 0 ? (size_t)fileSize : 0);
+	in.seekg(0, std::ios::beg);
+	in.read((char*)file.data(), file.size());
+	bool readOk = in.good();
+	in.close();
+
 	// Read the TGA Header
 	TGAHeader header;
-	in.read((char*)&header, sizeof(header));
-	if (!in.good())
+	if (!readOk || file.size() < sizeof(header))
 	{
 		std::cerr << "Unable to read TGA Header\n";
-		in.close();
 		return false;
 	}
+	memcpy(&header, file.data(), sizeof(header));
 
 	// Validate width/height/Bpp
+	if (m_OwnsData)
+		delete[] m_Data;
+	m_Data = m_Origin = nullptr;
+	m_Stride = 0;
+	m_OwnsData = true;
 	m_Width = header.Width;
 	m_Height = header.Height;
 	m_BytesPerPixel = header.BitsPerPixel >> 3;
 	if (m_Width <= 0 || m_Height <= 0 || (m_BytesPerPixel != 1 && m_BytesPerPixel != 3 && m_BytesPerPixel != 4))
 	{
 		std::cerr << "Invalid Width or Height or BytesPerPixel\n";
-		in.close();
+		m_Width = m_Height = m_BytesPerPixel = 0;
 		return false;
 	}
 
-	// Read the data
-	unsigned long nbytes = m_Width * m_Height * m_BytesPerPixel;
-	m_Data = new uint8_t[nbytes];
-
-	if (header.ImageType == 2 || header.ImageType == 3) // True Color or Gray Scale
-	{
-		in.read((char*)m_Data, nbytes);
-		if (!in.good())
-		{
-			std::cerr << "Unable to read TGA Data\n";
-			in.close();
-			return false;
-		}
-	}
-	if (header.ImageType == 10 || header.ImageType == 11) // RLE Data
+	bool rle = header.ImageType == 10 || header.ImageType == 11;
+	if (!rle && header.ImageType != 2 && header.ImageType != 3) // True Color or Gray Scale
 	{
-		if (!LoadRLEData(in))
-		{
-			std::cerr << "Unable to read TGA RLE Data\n";
-			in.close();
-			return false;
-		}
+		std::cerr << "Unsupported/Invalid Image Type" << (int)header.ImageType << "\n";
+		m_Width = m_Height = m_BytesPerPixel = 0;
+		return false;
 	}
-	else
+
+	// Skip the image ID and the color map, then decode the data
+	size_t offset = sizeof(header) + header.IDLength;
+	if (header.ColorMapType)
+		offset += header.ColorMapLength * ((header.ColorMapEntrySize + 7) >> 3);
+
+	m_Data = new uint8_t[(size_t)m_Width * m_Height * m_BytesPerPixel];
+	const uint8_t* src = file.data() + std::min(offset, file.size());
+	const uint8_t* end = file.data() + file.size();
+	if (!DecodePixels(src, end, rle, (header.ImageDescriptor & 0x10) != 0))
 	{
-		std::cerr << "Unsupported/Invalid Image Type" << (int)header.ImageType << "\n";
-		in.close();
+		std::cerr << "Unable to read TGA " << (rle ? "RLE " : "") << "Data\n";
+		delete[] m_Data;
+		m_Data = nullptr;
+		m_Width = m_Height = m_BytesPerPixel = 0;
 		return false;
 	}
 
+	// Rows stay in file order, a top left origin is handled by walking them backwards
+	m_Origin = m_Data;
+	m_Stride = m_Width * m_BytesPerPixel;
+	if (header.ImageDescriptor & 0x20)
+		FlipVertical();
+
 	std::clog << "Read tga image " << filename << " : " << m_Width << "x" << m_Height << "/" << m_BytesPerPixel * 8 << "\n";
-	in.close();
 	return true;
 }
 
-bool TGAImage::WriteTGAImage(const char* filename)
+// Appends one row as RLE packets, packets never cross a row boundary
+static void EncodeRLERow(const uint8_t* row, int width, uint8_t bytesPerPixel, std::vector<uint8_t>& out)
+{
+	auto same = [&](int a, int b) { return memcmp(row + a * bytesPerPixel, row + b * bytesPerPixel, bytesPerPixel) == 0; };
+
+	int x = 0;
+	while (x < width)
+	{
+		int run = 1;
+		while (x + run < width && run < 128 && same(x, x + run)) run++;
+		if (run > 1)
+		{
+			out.push_back((uint8_t)(0x80 | (run - 1)));
+			out.insert(out.end(), row + x * bytesPerPixel, row + (x + 1) * bytesPerPixel);
+			x += run;
+			continue;
+		}
+
+		// Raw packet, ends where two equal neighbours start a run
+		int n = 1;
+		while (x + n < width && n < 128 && (x + n + 1 >= width || !same(x + n, x + n + 1))) n++;
+		out.push_back((uint8_t)(n - 1));
+		out.insert(out.end(), row + x * bytesPerPixel, row + (x + n) * bytesPerPixel);
+		x += n;
+	}
+}
+
+bool TGAImage::WriteTGAImage(const char* filename, bool rle) const
 {
 	// Open the file
 	std::ofstream out;
@@ -108,7 +198,9 @@ bool TGAImage::WriteTGAImage(const char* filename)
 	header.Height = m_Height;
 	header.BitsPerPixel = m_BytesPerPixel << 3;
 	header.ImageType = (m_BytesPerPixel == 1) ? 3 : 2;
-	header.ImageDescriptor = 0x20;	// Top Left origin
+	if (rle)
+		header.ImageType += 8;
+	header.ImageDescriptor = m_Stride < 0 ? 0x20 : 0x00;	// Rows are written in memory order, the origin tells in which direction
 	out.write((char*)&header, sizeof(header));
 	if (!out.good())
 	{
@@ -118,7 +210,21 @@ bool TGAImage::WriteTGAImage(const char* filename)
 	}
 
 	// Write the data
-	out.write((char*)m_Data, m_Width * m_Height * m_BytesPerPixel);
+	if (!rle)
+	{
+		out.write((char*)m_Data, (size_t)m_Width * m_Height * m_BytesPerPixel);
+	}
+	else
+	{
+		std::vector<uint8_t> packets;
+		packets.reserve((size_t)m_Width * m_BytesPerPixel * 2);
+		for (int y = 0; y < m_Height && out.good(); y++)
+		{
+			packets.clear();
+			EncodeRLERow(m_Data + (size_t)y * m_Width * m_BytesPerPixel, m_Width, m_BytesPerPixel, packets);
+			out.write((char*)packets.data(), packets.size());
+		}
+	}
 	if (!out.good())
 	{
 		std::cerr << "Unable to write TGA Data\n";
@@ -135,7 +241,7 @@ TGAColor TGAImage::GetPixel(int x, int y) const
 	if (!m_Data || x < 0 || y < 0 || x >= m_Width || y >= m_Height)
 		return TGAColor();
 
-	return TGAColor(m_Data + (x + y * m_Width) * m_BytesPerPixel, m_BytesPerPixel);
+	return TGAColor(GetRow(y) + x * m_BytesPerPixel, m_BytesPerPixel);
 }
 
 bool TGAImage::SetPixel(int x, int y, const TGAColor& c)
@@ -146,98 +252,137 @@ bool TGAImage::SetPixel(int x, int y, const TGAColor& c)
 	if (x < 0 || y < 0 || x >= m_Width || y >= m_Height)
 		return false;
 	
-	memcpy(m_Data + (x + y * m_Width) * m_BytesPerPixel, c.Raw, m_BytesPerPixel);
+	memcpy(GetRow(y) + x * m_BytesPerPixel, c.Raw, m_BytesPerPixel);
 	return true;
 }
 
-bool TGAImage::FlipVertical()
+void TGAImage::Clear(const TGAColor& c)
 {
 	if (!m_Data)
-		return false;
+		return;
 
-	unsigned long bytesPerLine = m_Width * m_BytesPerPixel;
-	uint8_t* line = new uint8_t[bytesPerLine];
-	uint16_t halfHeight = m_Height >> 1;
-	for (uint16_t i = 0; i < halfHeight; i++)
+	size_t rowBytes = (size_t)m_Width * m_BytesPerPixel;
+	bool uniform = true;
+	for (int i = 1; i < m_BytesPerPixel; i++)
+		uniform &= c.Raw[i] == c.Raw[0];
+	if (uniform)
 	{
-		unsigned long upperLineStart = i * bytesPerLine;
-		unsigned long lowerLineStart = (m_Height - 1 - i) * bytesPerLine;
-		// Swap
-		memmove((void*)line, (void*)(m_Data + upperLineStart), bytesPerLine);
-		memmove((void*)(m_Data + upperLineStart), (void*)(m_Data + lowerLineStart), bytesPerLine);
-		memmove((void*)(m_Data + lowerLineStart), (void*)line, bytesPerLine);
+		// Rows are contiguous whichever way they are ordered
+		memset(m_Data, c.Raw[0], rowBytes * m_Height);
+		return;
 	}
 
-	delete[] line;
+	// Fill one row pixel by pixel and copy it to the others
+	uint8_t* first = GetRow(0);
+	for (int x = 0; x < m_Width; x++)
+		memcpy(first + x * m_BytesPerPixel, c.Raw, m_BytesPerPixel);
+	for (int y = 1; y < m_Height; y++)
+		memcpy(GetRow(y), first, rowBytes);
+}
+
+bool TGAImage::FlipVertical()
+{
+	if (!m_Data)
+		return false;
+
+	// Only the row order changes, the pixels stay where they are
+	m_Origin += (m_Height - 1) * m_Stride;
+	m_Stride = -m_Stride;
 	return true;
 }
 
+template<typename Pixel>
+static void ReverseRows(uint8_t* data, int width, int height, size_t bytesPerLine)
+{
+	for (int y = 0; y < height; y++)
+	{
+		Pixel* row = (Pixel*)(data + y * bytesPerLine);
+		std::reverse(row, row + width);
+	}
+}
+
+struct RGB8Pixel
+{
+	uint8_t Raw[3];
+};
+
 bool TGAImage::FlipHorizontal()
 {
 	if (!m_Data)
 		return false;
 
-	uint16_t halfWidth = m_Width >> 1;
-	for (uint16_t i = 0; i < halfWidth; i++)
+	size_t bytesPerLine = (size_t)m_Width * m_BytesPerPixel;
+	switch (m_BytesPerPixel)
 	{
-		for (uint16_t j = 0; j < m_Height; j++)
-		{
-			TGAColor c1 = GetPixel(i, j);
-			TGAColor c2 = GetPixel(m_Width - 1 - i, j);
-			SetPixel(i, j, c2);
-			SetPixel(m_Width - 1 - i, j, c1);
-		}
+	case 1: ReverseRows<uint8_t>(m_Data, m_Width, m_Height, bytesPerLine); break;
+	case 3: ReverseRows<RGB8Pixel>(m_Data, m_Width, m_Height, bytesPerLine); break;
+	case 4: ReverseRows<uint32_t>(m_Data, m_Width, m_Height, bytesPerLine); break;
 	}
+	return true;
 }
 
-bool TGAImage::LoadRLEData(std::ifstream& in)
+// Fills count pixels with the same value by doubling the already written span
+static void FillPixels(uint8_t* dst, const uint8_t* pixel, size_t count, uint8_t bytesPerPixel)
 {
-	uint64_t pixelCount = m_Width * m_Height;
-	uint64_t index = 0;
-	TGAColor colorBuffer;
-	
-	while (index < pixelCount)
+	if (bytesPerPixel == 1)
+	{
+		memset(dst, pixel[0], count);
+		return;
+	}
+
+	memcpy(dst, pixel, bytesPerPixel);
+	size_t filled = 1;
+	while (filled < count)
+	{
+		size_t n = std::min(filled, count - filled);
+		memcpy(dst + filled * bytesPerPixel, dst, n * bytesPerPixel);
+		filled += n;
+	}
+}
+
+bool TGAImage::DecodePixels(const uint8_t* src, const uint8_t* end, bool rle, bool rightToLeft)
+{
+	size_t bytesPerLine = (size_t)m_Width * m_BytesPerPixel;
+	uint8_t* dst = m_Data;
+	uint8_t* dataEnd = m_Data + bytesPerLine * m_Height;
+
+	while (dst < dataEnd)
 	{
-		uint8_t packetHeader = 0;
-		packetHeader = in.get();
-		if (!in.good())
+		size_t count;
+		bool run = false;
+		if (!rle)
 		{
-			std::cerr << "An errror occured while reading the data\n";
-			return false;
+			count = (size_t)m_Width * m_Height;
 		}
+		else
+		{
+			if (src >= end)
+				return false;
 
-		if (packetHeader < 128) // Raw
+			uint8_t packetHeader = *src++;
+			count = (packetHeader & 0x7f) + 1;
+			run = packetHeader >= 128;
+		}
+
+		size_t nbytes = std::min(count * m_BytesPerPixel, (size_t)(dataEnd - dst));
+		if (run)
 		{
-			for (int i = 0; i < packetHeader + 1; i++)
-			{
-				in.read((char*)colorBuffer.Raw, m_BytesPerPixel);
-				if (!in.good())
-				{
-					std::cerr << "An errror occured while reading the header\n";
-					return false;
-				}
-				for (int t = 0; t < m_BytesPerPixel; t++) m_Data[index * m_BytesPerPixel + t] = colorBuffer.Raw[t];
-				index++;
-			}
+			if (end - src < m_BytesPerPixel)
+				return false;
+			FillPixels(dst, src, nbytes / m_BytesPerPixel, m_BytesPerPixel);
+			src += m_BytesPerPixel;
 		}
-		else // RLE
+		else
 		{
-			in.read((char*)colorBuffer.Raw, m_BytesPerPixel);
-
-			if (!in.good())
-			{
-				std::cerr << "An errror occured while reading the header\n";
+			if ((size_t)(end - src) < nbytes)
 				return false;
-			}
-			for (int i = 0; i < packetHeader - 127; i++)
-			{
-				for (int t = 0; t < m_BytesPerPixel; t++)
-					m_Data[index*m_BytesPerPixel + t] = colorBuffer.Raw[t];
-				index++;
-			}
+			memcpy(dst, src, nbytes);
+			src += nbytes;
 		}
+		dst += nbytes;
 	}
 
+	if (rightToLeft)
+		FlipHorizontal();
 	return true;
 }
-
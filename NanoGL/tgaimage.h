@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
@@ -83,24 +85,80 @@ public:
 	~TGAImage();
 	TGAImage();
 	TGAImage(uint16_t width, uint16_t height, uint8_t bytesPerPixel);
+	// Wraps caller-owned memory of tightly packed rows without copying it, the memory must outlive the image.
+	// data is the first row in memory, which is the bottom row unless topDown is set.
+	TGAImage(uint8_t* data, uint16_t width, uint16_t height, uint8_t bytesPerPixel, bool topDown = false);
+	TGAImage(const TGAImage& img);
+	TGAImage(TGAImage&& img);
+	TGAImage& operator=(const TGAImage& img);
+	TGAImage& operator=(TGAImage&& img);
 
 	bool ReadTGAImage(const char* filename);
-	bool WriteTGAImage(const char* filename);
+	bool WriteTGAImage(const char* filename, bool rle = false) const;
 
 	TGAColor GetPixel(int x, int y) const;
 	bool SetPixel(int x, int y, const TGAColor& c);
+	void Clear(const TGAColor& c = TGAColor());
 
 	uint16_t GetWidth() const { return m_Width; }
 	uint16_t GetHeight() const { return m_Height; }
 	uint8_t GetBytesPerPixel() const { return m_BytesPerPixel; }
 	uint8_t* GetBuffer() const { return m_Data; }
+	bool OwnsBuffer() const { return m_OwnsData; }
+	uint8_t* GetRow(int y) const { return m_Origin + y * m_Stride; }
+	ptrdiff_t GetStride() const { return m_Stride; }	// Negative when the rows are stored top to bottom
 
 	bool FlipVertical();
 	bool FlipHorizontal();
 private:
-	bool LoadRLEData(std::ifstream& in);
+	bool DecodePixels(const uint8_t* src, const uint8_t* end, bool rle, bool rightToLeft);
 private:
 	uint16_t m_Width = 0, m_Height = 0;
 	uint8_t m_BytesPerPixel = 0;
 	uint8_t* m_Data = nullptr;
-};
\ No newline at end of file
+	uint8_t* m_Origin = nullptr;	// Start of row 0, rows are m_Stride bytes apart
+	ptrdiff_t m_Stride = 0;
+	bool m_OwnsData = true;		// false for wrapped memory, copies always own theirs
+};
+
+// Unchecked pixel access with the pixel size known at compile time.
+// Coordinates are not validated, callers must keep them inside the image.
+template<uint8_t BPP>
+class TGAImageView
+{
+public:
+	TGAImageView(uint8_t* data, int width, int height, ptrdiff_t stride)
+		: m_Data(data), m_Width(width), m_Height(height), m_Stride(stride)
+	{}
+
+	explicit TGAImageView(const TGAImage& img)
+		: m_Data(img.GetRow(0)), m_Width(img.GetWidth()), m_Height(img.GetHeight()), m_Stride(img.GetStride())
+	{
+		assert(img.GetBytesPerPixel() == BPP);
+	}
+
+	uint8_t* Row(int y) const { return m_Data + y * m_Stride; }
+
+	TGAColor Get(int x, int y) const
+	{
+		TGAColor c;
+		memcpy(c.Raw, Row(y) + x * BPP, BPP);
+		return c;
+	}
+
+	void Set(int x, int y, const TGAColor& c) const
+	{
+		memcpy(Row(y) + x * BPP, c.Raw, BPP);
+	}
+
+	int GetWidth() const { return m_Width; }
+	int GetHeight() const { return m_Height; }
+private:
+	uint8_t* m_Data;
+	int m_Width, m_Height;
+	ptrdiff_t m_Stride;
+};
+
+typedef TGAImageView<1> TGAViewR8;
+typedef TGAImageView<3> TGAViewRGB8;
+typedef TGAImageView<4> TGAViewRGBA8;
\ No newline at end of file
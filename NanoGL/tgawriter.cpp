@@ -0,0 +1,139 @@
+#include "tgawriter.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <iostream>
+
+TGAWriter::TGAWriter()
+	: m_Thread(&TGAWriter::Run, this)
+{
+}
+
+TGAWriter::~TGAWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+	}
+	m_JobAdded.notify_one();
+	m_Thread.join();
+}
+
+void TGAWriter::Enqueue(TGAImage image, const std::string& filename, bool rle)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Queue.push_back(Job{ std::move(image), filename, rle });
+	}
+	m_JobAdded.notify_one();
+}
+
+bool TGAWriter::Flush()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_JobDone.wait(lock, [this] { return m_Queue.empty() && m_Busy == 0; });
+	bool ok = !m_Failed;
+	m_Failed = false;
+	return ok;
+}
+
+void TGAWriter::Run()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while (true)
+	{
+		m_JobAdded.wait(lock, [this] { return m_Stop || !m_Queue.empty(); });
+		if (m_Queue.empty())
+			return;
+
+		Job job = std::move(m_Queue.front());
+		m_Queue.pop_front();
+		m_Busy++;
+
+		lock.unlock();
+		bool ok;
+		{
+			NANOGL_PROFILE_SCOPE(ProfilePass::ImageWrite);
+			ok = job.Image.WriteTGAImage(job.Filename.c_str(), job.RLE);
+		}
+		lock.lock();
+
+		m_Failed |= !ok;
+		m_Busy--;
+		m_JobDone.notify_all();
+	}
+}
+
+TGATileWriter::~TGATileWriter()
+{
+	if (m_Out.is_open())
+		Close();
+}
+
+bool TGATileWriter::Open(const char* filename, uint16_t width, uint16_t height, uint8_t bytesPerPixel)
+{
+	m_Out.open(filename, std::ios::binary);
+	if (!m_Out.is_open())
+	{
+		std::cerr << "Error opening file " << filename << "\n";
+		return false;
+	}
+	m_Filename = filename;
+	m_Width = width;
+	m_Height = height;
+	m_BytesPerPixel = bytesPerPixel;
+
+	TGAHeader header;
+	memset((void*)&header, 0, sizeof(header));
+	header.Width = width;
+	header.Height = height;
+	header.BitsPerPixel = bytesPerPixel << 3;
+	header.ImageType = (bytesPerPixel == 1) ? 3 : 2;
+	m_Out.write((char*)&header, sizeof(header));
+	if (!m_Out.good())
+	{
+		std::cerr << "Unable to write TGA Header\n";
+		return false;
+	}
+	return true;
+}
+
+bool TGATileWriter::WriteRegion(const TGAImage& image, int x, int y)
+{
+	if (image.GetBytesPerPixel() != m_BytesPerPixel)
+	{
+		std::cerr << "Region of " << (int)image.GetBytesPerPixel() << " bytes per pixel doesn't match " << m_Filename << "\n";
+		return false;
+	}
+
+	NANOGL_PROFILE_SCOPE(ProfilePass::ImageWrite);
+	int x0 = std::max(x, 0), x1 = std::min(x + (int)image.GetWidth(), (int)m_Width);
+	int y0 = std::max(y, 0), y1 = std::min(y + (int)image.GetHeight(), (int)m_Height);
+	for (int row = y0; row < y1 && x0 < x1; row++)
+	{
+		std::streamoff offset = sizeof(TGAHeader) + ((std::streamoff)row * m_Width + x0) * m_BytesPerPixel;
+		m_Out.seekp(offset);
+		m_Out.write((const char*)image.GetRow(row - y) + (size_t)(x0 - x) * m_BytesPerPixel, (std::streamsize)(x1 - x0) * m_BytesPerPixel);
+	}
+	if (!m_Out.good())
+	{
+		std::cerr << "Unable to write TGA Data\n";
+		return false;
+	}
+	return true;
+}
+
+bool TGATileWriter::Close()
+{
+	// The file gets its full size even if the last regions were never written, they read as zeros
+	m_Out.seekp(0, std::ios::end);
+	std::streamoff size = sizeof(TGAHeader) + (std::streamoff)m_Width * m_Height * m_BytesPerPixel;
+	if (m_Out.tellp() < size)
+	{
+		m_Out.seekp(size - 1);
+		m_Out.put(0);
+	}
+	bool ok = m_Out.good();
+	m_Out.close();
+	return ok;
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "tgaimage.h"
+
+// Encodes and writes queued images on a background thread, so the caller can go on rendering the next frame.
+// The destructor writes out whatever is still queued.
+class TGAWriter
+{
+public:
+	TGAWriter();
+	~TGAWriter();
+
+	TGAWriter(const TGAWriter&) = delete;
+	TGAWriter& operator=(const TGAWriter&) = delete;
+
+	void Enqueue(TGAImage image, const std::string& filename, bool rle = true);
+	bool Flush();	// Blocks until the queue is empty, returns false if any write since the last flush failed
+private:
+	void Run();
+private:
+	struct Job
+	{
+		TGAImage Image;
+		std::string Filename;
+		bool RLE;
+	};
+
+	std::deque<Job> m_Queue;
+	std::mutex m_Mutex;
+	std::condition_variable m_JobAdded;
+	std::condition_variable m_JobDone;
+	int m_Busy = 0;
+	bool m_Failed = false;
+	bool m_Stop = false;
+	std::thread m_Thread;
+};
+
+// Writes an uncompressed TGA file region by region, so an image bigger than memory never has to be held as a whole.
+// Rows are stored bottom to top like TGAImage keeps them, regions may be written in any order.
+class TGATileWriter
+{
+public:
+	TGATileWriter() = default;
+	~TGATileWriter();
+
+	TGATileWriter(const TGATileWriter&) = delete;
+	TGATileWriter& operator=(const TGATileWriter&) = delete;
+
+	bool Open(const char* filename, uint16_t width, uint16_t height, uint8_t bytesPerPixel);
+	// Writes image with its bottom left pixel at (x, y), the part outside the file's image is dropped
+	bool WriteRegion(const TGAImage& image, int x, int y);
+	bool Close();
+private:
+	std::ofstream m_Out;
+	std::string m_Filename;
+	uint16_t m_Width = 0, m_Height = 0;
+	uint8_t m_BytesPerPixel = 0;
+};
\ No newline at end of file
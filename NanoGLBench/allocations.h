@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstdint>
+
+// Every heap allocation of the process is counted, steady state rendering is expected to make none.
+// The replacement operators live in allocations.cpp so the compiler never inlines them into their callers.
+uint64_t GetHeapAllocations();
\ No newline at end of file
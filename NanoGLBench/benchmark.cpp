@@ -0,0 +1,759 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "allocations.h"
+#include "depthbuffer.h"
+#include "fastmath.h"
+#include "geometry.h"
+#include "model.h"
+#include "ModelRenderer.h"
+#include "nanogl.h"
+#include "profiler.h"
+#include "shaders.h"
+#include "texture.h"
+#include "texturecache.h"
+#include "tgaimage.h"
+
+#include "scenes.h"
+
+// Usage: NanoGLBench [--max-triangles N] [--size N] [--repeat N] [--out file.json]
+// Every benchmark is run --repeat times after one warm up run, the JSON report holds the statistics of the samples.
+
+struct Options
+{
+	int MaxTriangles = 100000;
+	int Size = 256;		// render target width and height
+	int Repeat = 7;
+	std::string Output = "benchmark.json";
+};
+
+struct Result
+{
+	std::string Name;
+	uint64_t Items;		// work done per sample: triangles, pixels or iterations
+	std::vector<double> Samples;	// milliseconds
+	int64_t Allocations;	// most heap allocations of one sample, -1 when not counted
+	double MaxError;	// largest deviation from the exact result, -1 when not applicable
+};
+
+static std::vector<Result> results;
+
+// Culling of the renderers of the current scene, back faces of the closed shapes and none for the open terrain
+static CullMode sceneCullMode = CullMode::None;
+
+// Nearest rank percentile of sorted samples
+static double Percentile(const std::vector<double>& sorted, double p)
+{
+	size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+	return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+static double Median(const std::vector<double>& sorted)
+{
+	size_t n = sorted.size();
+	return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+static void AddResult(const std::string& name, uint64_t items, std::vector<double> samples, int64_t allocations = -1)
+{
+	std::sort(samples.begin(), samples.end());
+	std::cerr << name << ": median " << Median(samples) << " ms, p90 " << Percentile(samples, 90) << " ms";
+	if (allocations >= 0)
+		std::cerr << ", " << allocations << " allocations";
+	std::cerr << std::endl;
+	results.push_back(Result{ name, items, std::move(samples), allocations, -1 });
+}
+
+// Attaches the accuracy of an approximation to the result measured last
+static void AddMaxError(double maxError)
+{
+	results.back().MaxError = maxError;
+	std::cerr << "  max error " << maxError << std::endl;
+}
+
+template<typename F>
+static void Measure(const std::string& name, uint64_t items, int repeat, F&& run)
+{
+	run();
+	std::vector<double> samples;
+	for (int i = 0; i < repeat; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		run();
+		samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	}
+	AddResult(name, items, std::move(samples));
+}
+
+static bool WriteReport(const Options& options)
+{
+	std::ofstream out(options.Output);
+	if (!out.is_open())
+	{
+		std::cerr << "Can't open file " << options.Output << std::endl;
+		return false;
+	}
+
+	out << "{\n  \"config\": { \"max_triangles\": " << options.MaxTriangles << ", \"size\": " << options.Size << ", \"repeat\": " << options.Repeat << " },\n";
+	out << "  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const Result& r = results[i];
+		const std::vector<double>& s = r.Samples;
+		double mean = 0;
+		for (double v : s) mean += v / s.size();
+		out << "    { \"name\": \"" << r.Name << "\", \"items\": " << r.Items << ", \"samples\": " << s.size()
+			<< ", \"min_ms\": " << s.front() << ", \"median_ms\": " << Median(s) << ", \"p90_ms\": " << Percentile(s, 90)
+			<< ", \"p99_ms\": " << Percentile(s, 99) << ", \"max_ms\": " << s.back() << ", \"mean_ms\": " << mean
+			<< ", \"ns_per_item\": " << (r.Items ? Median(s) * 1e6 / r.Items : 0.0);
+		if (r.Allocations >= 0)
+			out << ", \"allocations\": " << r.Allocations;
+		if (r.MaxError >= 0)
+			out << ", \"max_error\": " << r.MaxError;
+		out << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+	return out.good();
+}
+
+// Scene setup shared by the benchmarks, matches main.cpp
+static const Vec3f lightDir(1, 1, 2);
+static const Vec3f eye(1, 1, 4);
+static const Vec3f center(0, 0, 0);
+static const Vec3f up(0, 1, 0);
+
+static void ClearDepth(std::vector<float>& buffer)
+{
+	std::fill(buffer.begin(), buffer.end(), -std::numeric_limits<float>::max());
+}
+
+static void DrawModel(const Model& model, IShader& shader, TGAImage& image, std::vector<float>& zbuffer)
+{
+	ClearDepth(zbuffer);
+	Vec4f screenCoords[3];
+	for (int i = 0; i < model.nFaces(); i++)
+	{
+		for (int j = 0; j < 3; j++)
+			screenCoords[j] = shader.Vertex(i, j);
+		Triangle(screenCoords, shader, image, zbuffer.data());
+	}
+}
+
+static void BenchmarkShaders(const std::string& scene, const Model& model, const Options& options)
+{
+	int size = options.Size;
+	TGAImage image(size, size, 3), AOImage(size, size, 3);
+	std::vector<float> zbuffer((size_t)size * size), shadowbuffer((size_t)size * size);
+	ClearDepth(shadowbuffer);
+
+	SetCullMode(CullMode::Back);
+	LookAt(eye, center, up);
+	CreateViewportMatrix(size / 8, size / 8, size * 3 / 4, size * 3 / 4);
+	CreateProjectionMatrix(-1.0f / (eye - center).Magnitude());
+	Mat4x4 M = Viewport * Projection * ModelView;
+
+	ZShader zshader(model);
+	DepthShader depthShader(model);
+	DepthBuffer shadowDepth(shadowbuffer.data(), size, size);
+	Shader shader(M, M.InvertTranspose(), Mat4x4::Identity(), model, lightDir, &shadowDepth, &AOImage);
+	GouraudShader gouraudShader(model, lightDir);
+	ToonShader toonShader(model, lightDir);
+
+	struct { const char* Name; IShader* Shader; } shaders[] = {
+		{ "z", &zshader }, { "depth", &depthShader }, { "final", &shader }, { "gouraud", &gouraudShader }, { "toon", &toonShader }
+	};
+	for (auto& s : shaders)
+		Measure("triangle/" + std::string(s.Name) + "/" + scene, model.nFaces(), options.Repeat, [&] { DrawModel(model, *s.Shader, image, zbuffer); });
+
+	// The z pass with each depth format, cleared lazily like the renderer does
+	struct { const char* Name; DepthFormat Format; } formats[] = {
+		{ "float32", DepthFormat::Float32 }, { "unorm24", DepthFormat::Unorm24 }, { "unorm16", DepthFormat::Unorm16 }
+	};
+	for (auto& f : formats)
+	{
+		DepthBuffer depth(size, size, f.Format);
+		Measure("depth_format/" + std::string(f.Name) + "/" + scene, model.nFaces(), options.Repeat, [&]
+		{
+			depth.Clear();
+			Vec4f screenCoords[3];
+			for (int i = 0; i < model.nFaces(); i++)
+			{
+				for (int j = 0; j < 3; j++)
+					screenCoords[j] = zshader.Vertex(i, j);
+				Triangle(screenCoords, zshader, image, depth);
+			}
+		});
+	}
+	SetCullMode(CullMode::None);
+}
+
+static void BenchmarkPasses(const std::string& scene, const Model& model, const Options& options)
+{
+	int size = options.Size;
+	std::vector<uint8_t> pixels((size_t)size * size * 3);
+	std::vector<float> zbuffer((size_t)size * size);
+	ModelRenderer renderer(model);
+	renderer.SetCullMode(sceneCullMode);
+
+	// The horizon scan makes a full render expensive, so fewer samples are taken than for the other benchmarks
+	int repeat = std::max(3, options.Repeat / 2);
+	const ProfilePass passes[] = { ProfilePass::AORaster, ProfilePass::AOHorizon, ProfilePass::ShadowMap, ProfilePass::FinalShading };
+	const char* const names[] = { "ao_raster", "ao_horizon", "shadow_map", "final_shading" };
+	std::vector<double> samples[4], total;
+	int64_t allocations = 0;
+	for (int i = 0; i <= repeat; i++)
+	{
+		TGAImage frame(pixels.data(), size, size, 3);
+		ClearDepth(zbuffer);
+		Profiler::Get().BeginFrame();
+		uint64_t allocationsBefore = GetHeapAllocations();
+		auto start = std::chrono::steady_clock::now();
+		renderer.Render(frame, zbuffer.data(), Camera{ eye, center, up }, lightDir);
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (i == 0)
+			continue;	// warm up, the renderer's buffers are allocated here
+		allocations = std::max(allocations, (int64_t)(GetHeapAllocations() - allocationsBefore));
+		for (int p = 0; p < 4; p++)
+			samples[p].push_back(Profiler::Get().GetTime(passes[p]));
+		total.push_back(elapsed);
+	}
+	for (int p = 0; p < 4; p++)
+		AddResult("pass/" + std::string(names[p]) + "/" + scene, (uint64_t)size * size, samples[p]);
+	AddResult("render/" + scene, (uint64_t)size * size, total, allocations);
+}
+
+// A light sweep around a fixed camera, compared with full renders of the same frames in render/*
+static void BenchmarkRelight(const std::string& scene, const Model& model, const Options& options)
+{
+	int size = options.Size;
+	ModelRenderer renderer(model);
+	renderer.SetCullMode(sceneCullMode);
+	renderer.SetIncremental(true);
+	TGAImage frame(size, size, 3);
+	DepthBuffer depth(size, size);
+	renderer.Render(frame, depth, Camera{ eye, center, up }, lightDir);
+
+	int step = 0;
+	Measure("relight/" + scene, (uint64_t)size * size, options.Repeat, [&] {
+		float angle = 0.3f * step++;
+		renderer.Relight(frame, Vec3f(2 * std::cos(angle), 1, 2 * std::sin(angle)));
+	});
+}
+
+// One model drawn as a grid of n x n instances that fills the frame of render/*
+static void BenchmarkInstances(const std::string& scene, const Model& model, const Options& options)
+{
+	int size = options.Size;
+	TGAImage frame(size, size, 3);
+	DepthBuffer depth(size, size);
+	int repeat = std::max(3, options.Repeat / 2);
+	for (int n : { 2, 4 })
+	{
+		std::vector<Mat4x4> instances;
+		for (int i = 0; i < n; i++)
+		{
+			for (int j = 0; j < n; j++)
+			{
+				Mat4x4 transform = Mat4x4::Identity();
+				transform[0][0] = transform[1][1] = transform[2][2] = 1.0f / n;
+				transform[0][3] = (2.0f * i + 1) / n - 1;
+				transform[1][3] = (2.0f * j + 1) / n - 1;
+				instances.push_back(transform);
+			}
+		}
+		ModelRenderer renderer(model);
+		renderer.SetCullMode(sceneCullMode);
+		renderer.SetInstances(instances);
+		Measure("instances/" + std::to_string(n * n) + "/" + scene, (uint64_t)size * size, repeat, [&] {
+			depth.Clear();
+			renderer.Render(frame, depth, Camera{ eye, center, up }, lightDir);
+		});
+	}
+}
+
+// The frame of render/* in 16 tiles streamed to a file
+static void BenchmarkTiled(const std::string& scene, const Model& model, const Options& options)
+{
+	int size = options.Size;
+	ModelRenderer renderer(model);
+	renderer.SetCullMode(sceneCullMode);
+	int repeat = std::max(3, options.Repeat / 2);
+	Measure("tiled/" + scene, (uint64_t)size * size, repeat, [&] {
+		renderer.RenderTiled("bench_tiled.tga", size, size, Camera{ eye, center, up }, lightDir, (size + 3) / 4);
+	});
+	std::remove("bench_tiled.tga");
+}
+
+// Largest difference of any channel of two images of the same size
+static int MaxChannelDifference(const TGAImage& a, const TGAImage& b)
+{
+	int difference = 0;
+	const uint8_t* pa = a.GetBuffer();
+	const uint8_t* pb = b.GetBuffer();
+	for (size_t i = 0, n = (size_t)a.GetWidth() * a.GetHeight() * a.GetBytesPerPixel(); i < n; i++)
+		difference = std::max(difference, std::abs(pa[i] - pb[i]));
+	return difference;
+}
+
+// Largest channel difference the approximate math may cause in a rendered frame or AO image, as documented in fastmath.h
+static const int maxImageError[] = { 0, 1, 8 };
+
+// Renders with every math precision and compares the frame and the AO image to the exact render
+static bool BenchmarkPrecision(const std::string& scene, const Model& model, const Options& options)
+{
+	int size = options.Size;
+	ModelRenderer renderer(model);
+	renderer.SetCullMode(sceneCullMode);
+	TGAImage exactFrame(size, size, 3), exactAO(size, size, 3);
+	TGAImage frame(size, size, 3), AO(size, size, 3);
+	DepthBuffer depth(size, size);
+
+	const MathPrecision precisions[] = { MathPrecision::Exact, MathPrecision::Medium, MathPrecision::Fast };
+	const char* const names[] = { "exact", "medium", "fast" };
+	int repeat = std::max(3, options.Repeat / 2);
+	bool withinBounds = true, rendered = true;
+	for (int p = 0; p < 3; p++)
+	{
+		TGAImage& target = p ? frame : exactFrame;
+		TGAImage& targetAO = p ? AO : exactAO;
+		renderer.SetMathPrecision(precisions[p]);
+		Measure("precision/" + std::string(names[p]) + "/" + scene, (uint64_t)size * size, repeat, [&] {
+			target.Clear();
+			depth.Clear();
+			RenderOutputs outputs;
+			outputs.AmbientOcclusion = &targetAO;
+			rendered &= renderer.Render(target, depth, Camera{ eye, center, up }, lightDir, outputs);
+		});
+		if (!rendered)
+			return false;
+		int error = std::max(MaxChannelDifference(target, exactFrame), MaxChannelDifference(targetAO, exactAO));
+		AddMaxError(error);
+		if (error > maxImageError[p])
+		{
+			std::cerr << "  exceeds the bound of " << maxImageError[p] << std::endl;
+			withinBounds = false;
+		}
+	}
+	return withinBounds;
+}
+
+// Renders the scene with block compressed textures and compares the frame to the render of the uncompressed ones
+static void BenchmarkCompressedTextures(const std::string& scene, const std::string& filename, const Model& model, const Options& options)
+{
+	int size = options.Size;
+	Model compressed(filename.c_str(), nullptr, nullptr, nullptr, true);
+	ModelRenderer exactRenderer(model), renderer(compressed);
+	exactRenderer.SetCullMode(sceneCullMode);
+	renderer.SetCullMode(sceneCullMode);
+	TGAImage exactFrame(size, size, 3), frame(size, size, 3);
+	DepthBuffer depth(size, size);
+	if (!exactRenderer.Render(exactFrame, depth, Camera{ eye, center, up }, lightDir))
+		return;
+
+	bool rendered = true;
+	Measure("texture_format/bc/" + scene, (uint64_t)size * size, std::max(3, options.Repeat / 2), [&] {
+		frame.Clear();
+		depth.Clear();
+		rendered &= renderer.Render(frame, depth, Camera{ eye, center, up }, lightDir);
+	});
+	if (rendered)
+		AddMaxError(MaxChannelDifference(frame, exactFrame));
+}
+
+static void BenchmarkImages(const Options& options)
+{
+	const int size = 1024;
+	TGAImage image = GenerateImage(size, size, 3);
+	uint64_t pixels = (uint64_t)size * size;
+
+	Measure("tga_write/raw", pixels, options.Repeat, [&] { image.WriteTGAImage("bench_image_raw.tga", false); });
+	Measure("tga_write/rle", pixels, options.Repeat, [&] { image.WriteTGAImage("bench_image_rle.tga", true); });
+	TGAImage read;
+	Measure("tga_read/raw", pixels, options.Repeat, [&] { read.ReadTGAImage("bench_image_raw.tga"); });
+	Measure("tga_read/rle", pixels, options.Repeat, [&] { read.ReadTGAImage("bench_image_rle.tga"); });
+	Measure("texture_load", pixels, options.Repeat, [&] { Texture texture(image); });
+	TextureCache& cache = TextureCache::Get();
+	Measure("texture_cache/miss", pixels, options.Repeat, [&] { cache.Clear(); cache.Load("bench_image_raw.tga"); });
+	Measure("texture_cache/hit", pixels, options.Repeat, [&] { cache.Load("bench_image_raw.tga"); });
+	cache.Clear();
+	std::remove("bench_image_raw.tga");
+	std::remove("bench_image_rle.tga");
+}
+
+static void BenchmarkClears(const Options& options)
+{
+	const int size = 2048;
+	uint64_t pixels = (uint64_t)size * size;
+	std::vector<float> depth(pixels);
+	Measure("clear/depth_scalar", pixels, options.Repeat, [&] { for (size_t i = depth.size(); i--; depth[i] = -std::numeric_limits<float>::max()); });
+	Measure("clear/depth_fill", pixels, options.Repeat, [&] { FillDepth(depth.data(), depth.size(), -std::numeric_limits<float>::max()); });
+	DepthBuffer buffer(size, size);
+	Measure("clear/depth_tiles", pixels, options.Repeat, [&] { buffer.Clear(); });
+	Measure("clear/depth_tiles_resolve", pixels, options.Repeat, [&] { buffer.Clear(); buffer.GetData(); });
+	TGAImage image(size, size, 3);
+	Measure("clear/image_black", pixels, options.Repeat, [&] { image.Clear(); });
+	Measure("clear/image_color", pixels, options.Repeat, [&] { image.Clear(TGAColor(20, 40, 60)); });
+}
+
+// Clears a pixel of every depth format to the near and far end of the range and reads it back. The unorm formats
+// must decode to within a step and keep the encoded value within their bits.
+static bool DepthRangeRoundTrips()
+{
+	const float range = DepthBuffer::DefaultRange;
+	struct { const char* Name; DepthFormat Format; } formats[] = {
+		{ "float32", DepthFormat::Float32 }, { "unorm24", DepthFormat::Unorm24 }, { "unorm16", DepthFormat::Unorm16 }
+	};
+	bool roundTrips = true;
+	for (auto& f : formats)
+	{
+		DepthBuffer depth(1, 1, f.Format, range);
+		for (float z : { -range, range })
+		{
+			depth.Clear(z);
+			depth.Resolve();
+			float step = 0;
+			uint32_t encoded = 0, max = 0;
+			if (f.Format == DepthFormat::Unorm24)
+			{
+				UnormDepthView<uint32_t> view = depth.GetUnorm24View();
+				step = 1 / view.Scale;
+				encoded = view.Data[0];
+				max = (uint32_t)view.Max;
+			}
+			else if (f.Format == DepthFormat::Unorm16)
+			{
+				UnormDepthView<uint16_t> view = depth.GetUnorm16View();
+				step = 1 / view.Scale;
+				encoded = view.Data[0];
+				max = (uint32_t)view.Max;
+			}
+			if (encoded > max || std::abs(depth.GetDepth(0, 0) - z) > step)
+			{
+				std::cerr << "Depth " << z << " does not round trip through " << f.Name << std::endl;
+				roundTrips = false;
+			}
+		}
+	}
+	return roundTrips;
+}
+
+static volatile float sink;
+
+// Times a scalar function over the inputs and reports its worst error against the double precision reference,
+// relative errors are divided by the magnitude of the reference
+template<typename F, typename R>
+static void MeasureMath(const std::string& name, const std::vector<float>& inputs, int repeat, bool relative, F&& function, R&& reference)
+{
+	Measure(name, inputs.size(), repeat, [&] {
+		float sum = 0;
+		for (float x : inputs) sum += function(x);
+		sink = sum;
+	});
+	double maxError = 0;
+	for (float x : inputs)
+	{
+		double expected = reference((double)x);
+		double error = std::abs(function(x) - expected);
+		maxError = std::max(maxError, relative ? error / std::abs(expected) : error);
+	}
+	AddMaxError(maxError);
+}
+
+template<MathPrecision P>
+static void BenchmarkMath(const std::string& level, const Options& options)
+{
+	const int count = 1 << 16;
+	std::vector<float> wide(count), signedWide(count), upperUnit(count);
+	for (int i = 0; i < count; i++)
+	{
+		float t = (i + 0.5f) / count;
+		wide[i] = std::pow(10.0f, t * 6 - 3);	// 1e-3 .. 1e3
+		signedWide[i] = t * 40 - 20;
+		upperUnit[i] = 0.5f + t * 0.5f;	// pow(x, 100) stays a normal float
+	}
+
+	MeasureMath("math/rsqrt/" + level, wide, options.Repeat, true, [](float x) { return FastRsqrt<P>(x); }, [](double x) { return 1 / std::sqrt(x); });
+	MeasureMath("math/atan/" + level, signedWide, options.Repeat, false, [](float x) { return FastAtan<P>(x); }, [](double x) { return std::atan(x); });
+	MeasureMath("math/log2/" + level, wide, options.Repeat, false, [](float x) { return FastLog2<P>(x); }, [](double x) { return std::log2(x); });
+	MeasureMath("math/exp2/" + level, signedWide, options.Repeat, true, [](float x) { return FastExp2<P>(x); }, [](double x) { return std::exp2(x); });
+	// The AO falloff pow(total, 100), below 0.5 it is too small to matter
+	MeasureMath("math/pow/" + level, upperUnit, options.Repeat, true, [](float x) { return FastPow<P>(x, 100.0f); }, [](double x) { return std::pow(x, 100.0); });
+	MeasureMath("math/sin/" + level, signedWide, options.Repeat, false, [](float x) { float s, c; FastSinCos<P>(x, s, c); return s; }, [](double x) { return std::sin(x); });
+	MeasureMath("math/cos/" + level, signedWide, options.Repeat, false, [](float x) { float s, c; FastSinCos<P>(x, s, c); return c; }, [](double x) { return std::cos(x); });
+}
+
+// Encodes a generated image to every texture format and times random sampling, the memory of each is printed.
+// max_error is the largest difference of the channels the format keeps, against the source image.
+static void BenchmarkTextureFormats(const Options& options)
+{
+	const int size = 1024;
+	TGAImage image = GenerateImage(size, size, 3);
+	Texture exact(image);
+	const TextureFormat formats[] = { TextureFormat::BGRA8, TextureFormat::BC1, TextureFormat::BC4, TextureFormat::BC5 };
+	const char* const names[] = { "bgra8", "bc1", "bc4", "bc5" };
+	const uint32_t channels[] = { 0xffffff, 0xffffff, 0x0000ff, 0xffff00 };
+
+	const int samples = 1 << 20;
+	std::vector<Vec2f> uvs(samples);
+	uint32_t state = 1;
+	for (Vec2f& uv : uvs)
+	{
+		state = state * 1664525 + 1013904223;
+		uv.x = (state >> 8) / 16777216.0f;
+		state = state * 1664525 + 1013904223;
+		uv.y = (state >> 8) / 16777216.0f;
+	}
+
+	for (int f = 0; f < 4; f++)
+	{
+		Texture texture;
+		Measure("texture_encode/" + std::string(names[f]), (uint64_t)size * size, options.Repeat, [&] { texture.Load(image, formats[f]); });
+		Measure("texture_sample/" + std::string(names[f]), samples, options.Repeat, [&] {
+			uint32_t sum = 0;
+			for (const Vec2f& uv : uvs) sum += texture.Sample(uv.x, uv.y).Val;
+			sink = (float)sum;
+		});
+		int error = 0;
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size; x++)
+			{
+				uint32_t a = exact.Fetch(x, y).Val & channels[f], b = texture.Fetch(x, y).Val & channels[f];
+				for (int shift = 0; shift < 24; shift += 8)
+					error = std::max(error, std::abs((int)((a >> shift) & 0xff) - (int)((b >> shift) & 0xff)));
+			}
+		}
+		AddMaxError(error);
+		std::cerr << "  " << texture.GetMemorySize() << " bytes" << std::endl;
+	}
+}
+
+// Largest difference of the entries relative to the largest entry of the expected matrix
+template<typename T>
+static double RelativeError(const Mat<4, 4, T>& m, const Mat<4, 4, double>& expected)
+{
+	double scale = 0, difference = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			scale = std::max(scale, std::abs(expected[i][j]));
+			difference = std::max(difference, std::abs(m[i][j] - expected[i][j]));
+		}
+	}
+	return difference / scale;
+}
+
+// Largest element difference of the float 4x4 product and inverse, SSE where it is compiled in, and of the scalar
+// closed-form inverse in double from the generic adjugate and loop versions evaluated in double, relative to the
+// largest element of the reference.
+// The matrices are random with a dominant diagonal, so they are well conditioned.
+static void MatrixErrors(double& productError, double& inverseError)
+{
+	productError = inverseError = 0;
+	uint32_t state = 1;
+	auto random = [&] { state = state * 1664525 + 1013904223; return (state >> 8) / 8388608.0f - 1.0f; };
+	for (int n = 0; n < 1000; n++)
+	{
+		Mat4x4 a, b;
+		Mat<4, 4, double> ad, bd;
+		for (int i = 0; i < 4; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				a[i][j] = random() + (i == j ? 4.0f : 0.0f);
+				b[i][j] = random() + (i == j ? 4.0f : 0.0f);
+				ad[i][j] = a[i][j];
+				bd[i][j] = b[i][j];
+			}
+		}
+
+		// The reference inverse goes through the generic adjugate, Mat<4, 4, double>::Invert would take the closed form
+		Mat<4, 4, double> cofactors = ad.Adjugate();
+		Mat<4, 4, double> expectedInverse = (cofactors / (cofactors[0] * ad[0])).Transpose();
+		Mat<4, 4, double> expectedProduct = ad * bd;
+		Mat4x4 product = a * b, inverse = a.Invert();
+		Mat<4, 4, double> closedFormInverse = ad.Invert();
+		productError = std::max(productError, RelativeError(product, expectedProduct));
+		inverseError = std::max(inverseError, RelativeError(inverse, expectedInverse));
+		inverseError = std::max(inverseError, RelativeError(closedFormInverse, expectedInverse));
+	}
+}
+
+// Largest relative error the float 4x4 product and inverse may have, a few float epsilons
+static const double maxMatrixError = 1e-5;
+
+// Returns false when the 4x4 product or inverse exceeds maxMatrixError
+static bool BenchmarkGeometry(const Options& options)
+{
+	const int iterations = 1 << 18;
+	Mat4x4 A = Mat4x4::Identity(), B = Mat4x4::Identity();
+	for (int i = 0; i < 4; i++)
+	{
+		for (int j = 0; j < 4; j++)
+			A[i][j] += 0.1f * std::sin(float(i * 4 + j));
+	}
+	// A rotation keeps repeated products bounded
+	B[0][0] = B[1][1] = std::cos(0.1f);
+	B[0][1] = -std::sin(0.1f);
+	B[1][0] = std::sin(0.1f);
+	Mat4x4 affine = A;
+	affine[3] = Embed<4>(Vec3f(0, 0, 0));
+	Mat<3, 3, float> A3;
+	for (int i = 0; i < 3; i++) A3[i] = Proj<3>(A[i]);
+
+	std::vector<Vec3f> points(1 << 12);
+	for (size_t i = 0; i < points.size(); i++)
+		points[i] = Vec3f(std::sin(i * 0.1f), std::cos(i * 0.3f), std::sin(i * 0.7f));
+
+	// Each iteration feeds the previous result back so the compiler can't hoist the work out of the loop
+	double productError, inverseError;
+	MatrixErrors(productError, inverseError);
+	Measure("mat4_mul", iterations, options.Repeat, [&] {
+		Mat4x4 m = A;
+		for (int i = 0; i < iterations; i++) m = m * B;
+		sink = m[0][0];
+	});
+	AddMaxError(productError);
+	Measure("mat4_invert", iterations, options.Repeat, [&] {
+		Mat4x4 m = A;
+		for (int i = 0; i < iterations; i++) m = m.Invert();
+		sink = m[0][0];
+	});
+	AddMaxError(inverseError);
+	Measure("mat4_invert_transpose", iterations, options.Repeat, [&] {
+		Mat4x4 m = A;
+		for (int i = 0; i < iterations; i++) m = m.InvertTranspose();
+		sink = m[0][0];
+	});
+	Measure("mat4_invert_affine", iterations, options.Repeat, [&] {
+		Mat4x4 m = affine;
+		for (int i = 0; i < iterations; i++) m = InvertAffine(m);
+		sink = m[0][0];
+	});
+	Measure("mat3_invert", iterations, options.Repeat, [&] {
+		Mat<3, 3, float> m = A3;
+		for (int i = 0; i < iterations; i++) m = m.Invert();
+		sink = m[0][0];
+	});
+	// The vertex transform chain the shaders run per vertex
+	Measure("vec4_transform_chain", iterations, options.Repeat, [&] {
+		float sum = 0;
+		for (int i = 0; i < iterations; i++)
+		{
+			Vec4f v = A * B * A * Embed<4>(points[i & (points.size() - 1)]);
+			v = v / v[3];
+			sum += v[0] + v[1] * v[2];
+		}
+		sink = sum;
+	});
+
+	if (productError > maxMatrixError || inverseError > maxMatrixError)
+	{
+		std::cerr << "  the 4x4 product or inverse exceeds the bound of " << maxMatrixError << std::endl;
+		return false;
+	}
+	return true;
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		bool hasValue = i + 1 < argc;
+		if (!strcmp(argv[i], "--max-triangles") && hasValue) options.MaxTriangles = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--size") && hasValue) options.Size = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--repeat") && hasValue) options.Repeat = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--out") && hasValue) options.Output = argv[++i];
+		else
+		{
+			std::cerr << "Usage: " << argv[0] << " [--max-triangles N] [--size N] [--repeat N] [--out file.json]" << std::endl;
+			return false;
+		}
+	}
+	options.Size = std::max(options.Size, 8);
+	options.Repeat = std::max(options.Repeat, 1);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+		return 1;
+
+	// The renderer reports every pass on std::clog, keep the benchmark output readable
+	std::streambuf* clogBuffer = std::clog.rdbuf(nullptr);
+
+	bool matricesWithinBounds = BenchmarkGeometry(options);
+	bool depthRoundTrips = DepthRangeRoundTrips();
+	BenchmarkImages(options);
+	BenchmarkClears(options);
+	BenchmarkTextureFormats(options);
+	BenchmarkMath<MathPrecision::Exact>("exact", options);
+	BenchmarkMath<MathPrecision::Medium>("medium", options);
+	BenchmarkMath<MathPrecision::Fast>("fast", options);
+
+	bool withinBounds = true;
+	const SceneShape shapes[] = { SceneShape::Sphere, SceneShape::Torus, SceneShape::Terrain };
+	for (int triangles = 1000; triangles <= options.MaxTriangles && triangles <= 10000000; triangles *= 10)
+	{
+		for (SceneShape shape : shapes)
+		{
+			std::string scene = std::string(GetShapeName(shape)) + "/" + std::to_string(triangles);
+			sceneCullMode = shape == SceneShape::Terrain ? CullMode::None : CullMode::Back;
+			std::string filename = "bench_" + std::string(GetShapeName(shape)) + "_" + std::to_string(triangles) + ".obj";
+			SceneMesh mesh = GenerateMesh(shape, triangles);
+			if (!WriteOBJ(mesh, filename) || !WriteTextures(filename, 512))
+				return 1;
+
+			// Cold loads, the textures are read again every time
+			Measure("model_load/" + scene, mesh.Faces.size(), std::max(1, options.Repeat / 2), [&] { TextureCache::Get().Clear(); Model model(filename.c_str()); });
+			{
+				Model model(filename.c_str());
+				BenchmarkShaders(scene, model, options);
+				BenchmarkPasses(scene, model, options);
+				BenchmarkRelight(scene, model, options);
+				BenchmarkTiled(scene, model, options);
+				BenchmarkInstances(scene, model, options);
+				withinBounds &= BenchmarkPrecision(scene, model, options);
+				BenchmarkCompressedTextures(scene, filename, model, options);
+			}
+
+			std::remove(filename.c_str());
+			std::string base = filename.substr(0, filename.find_last_of('.'));
+			for (const char* suffix : { "_diffuse.tga", "_nm_tangent.tga", "_spec.tga", "_glow.tga" })
+				std::remove((base + suffix).c_str());
+		}
+	}
+
+	std::clog.rdbuf(clogBuffer);
+	if (!WriteReport(options))
+		return 1;
+	std::cerr << "Results written to " << options.Output << std::endl;
+	if (!withinBounds)
+	{
+		std::cerr << "The approximate math exceeds its image error bounds" << std::endl;
+		return 1;
+	}
+	if (!matricesWithinBounds)
+	{
+		std::cerr << "The 4x4 matrix product or inverse deviates from the generic version" << std::endl;
+		return 1;
+	}
+	if (!depthRoundTrips)
+	{
+		std::cerr << "The depth formats do not keep the ends of the depth range" << std::endl;
+		return 1;
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include "scenes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+const char* GetShapeName(SceneShape shape)
+{
+	switch (shape)
+	{
+	case SceneShape::Sphere: return "sphere";
+	case SceneShape::Torus: return "torus";
+	default: return "terrain";
+	}
+}
+
+// Integer hash to [0, 1], independent of the standard library's random engines
+static float Hash(int x, int y)
+{
+	uint32_t h = (uint32_t)x * 374761393u + (uint32_t)y * 668265263u;
+	h = (h ^ (h >> 13)) * 1274126177u;
+	h ^= h >> 16;
+	return (h & 0xffffff) / float(0xffffff);
+}
+
+static float ValueNoise(float x, float y)
+{
+	int ix = (int)std::floor(x), iy = (int)std::floor(y);
+	float fx = x - ix, fy = y - iy;
+	fx = fx * fx * (3 - 2 * fx);
+	fy = fy * fy * (3 - 2 * fy);
+	float a = Hash(ix, iy) + (Hash(ix + 1, iy) - Hash(ix, iy)) * fx;
+	float b = Hash(ix, iy + 1) + (Hash(ix + 1, iy + 1) - Hash(ix, iy + 1)) * fx;
+	return a + (b - a) * fy;
+}
+
+static float TerrainHeight(float x, float z)
+{
+	float height = 0, amplitude = 0.15f, frequency = 2.0f;
+	for (int octave = 0; octave < 5; octave++)
+	{
+		height += amplitude * ValueNoise(x * frequency, z * frequency);
+		amplitude *= 0.5f;
+		frequency *= 2.0f;
+	}
+	return height;
+}
+
+static void Evaluate(SceneShape shape, float u, float v, Vec3f& position, Vec3f& normal)
+{
+	const float pi = 3.14159265f;
+	switch (shape)
+	{
+	case SceneShape::Sphere:
+	{
+		float theta = 2 * pi * u, phi = pi * (v - 0.5f);
+		normal = Vec3f(std::cos(phi) * std::cos(theta), std::sin(phi), std::cos(phi) * std::sin(theta));
+		position = normal;
+		break;
+	}
+	case SceneShape::Torus:
+	{
+		const float R = 0.7f, r = 0.3f;
+		float theta = 2 * pi * u, phi = 2 * pi * v;
+		normal = Vec3f(std::cos(phi) * std::cos(theta), std::sin(phi), std::cos(phi) * std::sin(theta));
+		position = Vec3f((R + r * std::cos(phi)) * std::cos(theta), r * std::sin(phi), (R + r * std::cos(phi)) * std::sin(theta));
+		break;
+	}
+	default:
+	{
+		const float e = 1e-3f;
+		float x = 2 * u - 1, z = 2 * v - 1;
+		position = Vec3f(x, TerrainHeight(x, z) - 0.5f, z);
+		normal = Vec3f(TerrainHeight(x - e, z) - TerrainHeight(x + e, z), 2 * e, TerrainHeight(x, z - e) - TerrainHeight(x, z + e)).Normalize();
+		break;
+	}
+	}
+}
+
+SceneMesh GenerateMesh(SceneShape shape, int triangles)
+{
+	int n = std::max(1, (int)std::lround(std::sqrt(triangles / 2.0)));
+
+	SceneMesh mesh;
+	mesh.Verts.reserve((size_t)(n + 1) * (n + 1));
+	mesh.UVs.reserve(mesh.Verts.capacity());
+	mesh.Norms.reserve(mesh.Verts.capacity());
+	for (int j = 0; j <= n; j++)
+	{
+		for (int i = 0; i <= n; i++)
+		{
+			Vec3f position, normal;
+			Vec2f uv(i / float(n), j / float(n));
+			Evaluate(shape, uv.x, uv.y, position, normal);
+			mesh.Verts.push_back(position);
+			mesh.UVs.push_back(uv);
+			mesh.Norms.push_back(normal);
+		}
+	}
+
+	mesh.Faces.reserve((size_t)n * n * 2);
+	for (int j = 0; j < n; j++)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			int a = j * (n + 1) + i, b = a + 1, c = a + n + 2, d = a + n + 1;
+			int quad[2][3] = { { a, b, c }, { a, c, d } };
+			for (int* f : quad)
+			{
+				// Orient by the surface normal, degenerate faces at the poles keep any order
+				Vec3f geometric = Cross(mesh.Verts[f[1]] - mesh.Verts[f[0]], mesh.Verts[f[2]] - mesh.Verts[f[0]]);
+				if (geometric * (mesh.Norms[f[0]] + mesh.Norms[f[1]] + mesh.Norms[f[2]]) < 0)
+					std::swap(f[1], f[2]);
+				mesh.Faces.push_back(Vec3i(f[0], f[1], f[2]));
+			}
+		}
+	}
+	return mesh;
+}
+
+bool WriteOBJ(const SceneMesh& mesh, const std::string& filename)
+{
+	std::ofstream out(filename);
+	if (!out.is_open())
+	{
+		std::cerr << "Can't open file " << filename << std::endl;
+		return false;
+	}
+
+	for (const Vec3f& v : mesh.Verts) out << "v " << v.x << ' ' << v.y << ' ' << v.z << '\n';
+	for (const Vec2f& vt : mesh.UVs) out << "vt " << vt.x << ' ' << vt.y << " 0\n";
+	for (const Vec3f& vn : mesh.Norms) out << "vn " << vn.x << ' ' << vn.y << ' ' << vn.z << '\n';
+	for (const Vec3i& f : mesh.Faces)
+	{
+		out << 'f';
+		for (int i = 0; i < 3; i++) out << ' ' << f[i] + 1 << '/' << f[i] + 1 << '/' << f[i] + 1;
+		out << '\n';
+	}
+	return out.good();
+}
+
+bool WriteTextures(const std::string& objFilename, int size)
+{
+	std::string base = objFilename.substr(0, objFilename.find_last_of('.'));
+
+	TGAImage diffuse(size, size, 3), normal(size, size, 3), specular(size, size, 1), glow(size, size, 3);
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			bool odd = ((x * 8 / size) + (y * 8 / size)) & 1;
+			diffuse.SetPixel(x, y, odd ? TGAColor(40, 90, 200) : TGAColor(40, 110, 30));
+			normal.SetPixel(x, y, TGAColor(128, 128, 255));
+			specular.SetPixel(x, y, TGAColor(20, 20, 20));
+		}
+	}
+
+	return diffuse.WriteTGAImage((base + "_diffuse.tga").c_str(), true)
+		&& normal.WriteTGAImage((base + "_nm_tangent.tga").c_str(), true)
+		&& specular.WriteTGAImage((base + "_spec.tga").c_str(), true)
+		&& glow.WriteTGAImage((base + "_glow.tga").c_str(), true);
+}
+
+TGAImage GenerateImage(int width, int height, int bytesPerPixel)
+{
+	TGAImage image(width, height, bytesPerPixel);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			// Flat checker squares in the lower half, noise above
+			uint8_t v = ((x / 32 + y / 32) & 1) ? 200 : 40;
+			if (y >= height / 2)
+				v = (uint8_t)(255 * ValueNoise(x * 0.05f, y * 0.05f));
+			image.SetPixel(x, y, TGAColor(v, (uint8_t)(v / 2), (uint8_t)(255 - v)));
+		}
+	}
+	return image;
+}
\ No newline at end of file
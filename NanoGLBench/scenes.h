@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "geometry.h"
+#include "tgaimage.h"
+
+// Deterministic synthetic content for the benchmarks, the same arguments always give the same files
+
+enum class SceneShape { Sphere, Torus, Terrain };
+
+struct SceneMesh
+{
+	std::vector<Vec3f> Verts;
+	std::vector<Vec2f> UVs;
+	std::vector<Vec3f> Norms;
+	std::vector<Vec3i> Faces;	// The same index is used for position, uv and normal
+};
+
+const char* GetShapeName(SceneShape shape);
+
+// Tessellates the shape as a regular grid with about the requested number of triangles.
+// Faces are counter clockwise seen from outside, like the models the renderer expects.
+SceneMesh GenerateMesh(SceneShape shape, int triangles);
+
+bool WriteOBJ(const SceneMesh& mesh, const std::string& filename);
+
+// Writes the _diffuse, _nm_tangent, _spec and _glow maps the Model loader looks for next to the OBJ file
+bool WriteTextures(const std::string& objFilename, int size);
+
+// Checker board with value noise, compresses partially with RLE like a typical render
+TGAImage GenerateImage(int width, int height, int bytesPerPixel);
\ No newline at end of file